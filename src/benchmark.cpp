@@ -0,0 +1,235 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "parser.h"
+#include "generator.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+struct benchmarkoptions {
+	int tables;
+	int fields;
+	double fkdensity;
+	int fkdepth;
+	int iterations;
+	unsigned int seed;
+	std::string schemafile;
+	bool keepschema;
+};
+
+struct phasetimings {
+	std::string name;
+	std::vector<double> ms;
+};
+
+static const char* field_types[] = { "int", "varchar(64)", "text", "float", "blob" };
+
+// writes a schema of tables t0..tN-1. tables are laid out in foreign key
+// chains of fkdepth + 1 tables, where each table references the previous
+// table in its chain. the first table in each chain is a root table. the
+// remaining fields of non-root tables become foreign keys to a random
+// earlier table with probability fkdensity.
+void synthesize_schema(const benchmarkoptions& opts, std::ostream& strm) {
+	std::mt19937 rng(opts.seed);
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	int chainlength = opts.fkdepth + 1;
+
+	strm << "{" << endl;
+	strm << "\t\"tables\" : {" << endl;
+	for (int i = 0; i < opts.tables; i++) {
+		bool isroot = (i % chainlength) == 0;
+		if (i > 0) strm << "," << endl;
+		strm << "\t\t\"t" << i << "\" : {" << endl;
+		strm << "\t\t\t\"fields\" : [" << endl;
+		strm << "\t\t\t\t[ \"id\", \"int\", \"not null\", \"primary\" ]";
+		for (int j = 1; j < opts.fields; j++) {
+			strm << "," << endl;
+			int keytable = -1;
+			if (!isroot && j == 1)
+				keytable = i - 1;
+			else if (!isroot && chance(rng) < opts.fkdensity)
+				keytable = std::uniform_int_distribution<int>(0, i - 1)(rng);
+
+			if (keytable != -1) {
+				strm << "\t\t\t\t[ \"f" << j << "\", \"int\", \"not null\", { \"reftable\":\"t" << keytable << "\", \"refkey\":\"id\" } ]";
+			} else {
+				strm << "\t\t\t\t[ \"f" << j << "\", \"" << field_types[j % 5] << "\" ]";
+			}
+		}
+		strm << endl << "\t\t\t]," << endl;
+		strm << "\t\t\t\"before_insert\":true, \"after_insert\":true," << endl;
+		strm << "\t\t\t\"before_update\":true, \"after_update\":true," << endl;
+		strm << "\t\t\t\"before_delete\":true, \"after_delete\":true" << endl;
+		strm << "\t\t}";
+	}
+	strm << endl << "\t}," << endl;
+	strm << "\t\"events\" : { \"barrier\" : [] }" << endl;
+	strm << "}" << endl;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+long peak_memory_kb() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return (long)(pmc.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024; // bytes on darwin
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void write_phase(const phasetimings& phase, std::ostream& strm) {
+	std::vector<double> sorted = phase.ms;
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0;
+	for (size_t i = 0; i < sorted.size(); i++) total += sorted[i];
+
+	strm << "\t\t\"" << phase.name << "\": { ";
+	strm << "\"min_ms\": " << sorted.front() << ", ";
+	strm << "\"median_ms\": " << sorted[sorted.size() / 2] << ", ";
+	strm << "\"mean_ms\": " << total / sorted.size() << ", ";
+	strm << "\"max_ms\": " << sorted.back() << " }";
+}
+
+bool parse_options(int argc, char* argv[], benchmarkoptions* opts) {
+	opts->tables = 100;
+	opts->fields = 10;
+	opts->fkdensity = 0.1;
+	opts->fkdepth = 3;
+	opts->iterations = 5;
+	opts->seed = 1;
+	opts->schemafile = "dbgenpp_benchmark.dbgen";
+	opts->keepschema = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--keep-schema") {
+			opts->keepschema = true;
+			continue;
+		}
+		if (i + 1 >= argc) return false;
+		std::string value = argv[++i];
+		if (arg == "--tables")
+			opts->tables = atoi(value.c_str());
+		else if (arg == "--fields")
+			opts->fields = atoi(value.c_str());
+		else if (arg == "--fk-density")
+			opts->fkdensity = atof(value.c_str());
+		else if (arg == "--fk-depth")
+			opts->fkdepth = atoi(value.c_str());
+		else if (arg == "--iterations")
+			opts->iterations = atoi(value.c_str());
+		else if (arg == "--seed")
+			opts->seed = (unsigned int)atoi(value.c_str());
+		else if (arg == "--schema-file")
+			opts->schemafile = value;
+		else
+			return false;
+	}
+	return opts->tables > 0 && opts->fields > 1 && opts->fkdepth >= 0 && opts->iterations > 0;
+}
+
+int main(int argc, char* argv[]) {
+	benchmarkoptions opts;
+	if (!parse_options(argc, argv, &opts)) {
+		cout << "usage: dbgenpp_benchmark [--tables N] [--fields N] [--fk-density F] [--fk-depth N]" << endl;
+		cout << "                         [--iterations N] [--seed N] [--schema-file path] [--keep-schema]" << endl << endl;
+		return 1;
+	}
+
+	std::ofstream schemastrm(opts.schemafile.c_str(), std::ios::trunc | std::ios::out);
+	if (!schemastrm) {
+		cerr << "cannot write " << opts.schemafile << endl;
+		return 2;
+	}
+	synthesize_schema(opts, schemastrm);
+	schemastrm.close();
+
+	phasetimings parse, sort, header, implementation;
+	parse.name = "parse_dbgen";
+	sort.name = "sort_tables";
+	header.name = "generate_document_header";
+	implementation.name = "generate_document_implementation";
+
+	size_t headerbytes = 0, implementationbytes = 0;
+	for (int i = 0; i < opts.iterations; i++) {
+		documentgenparser parser;
+		documentgen gen;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (!parser.parse_dbgen(opts.schemafile.c_str(), &gen)) {
+			return 2;
+		}
+		parse.ms.push_back(elapsed_ms(start));
+
+		// parse_dbgen includes the sort, so time it again in isolation on
+		// the already parsed tables
+		std::vector<tableinfo> sorted;
+		start = std::chrono::steady_clock::now();
+		parser.sort_tables(gen.tables, sorted);
+		sort.ms.push_back(elapsed_ms(start));
+
+		std::ostringstream headerstrm;
+		start = std::chrono::steady_clock::now();
+		gen.generate_document_header("benchmark", headerstrm);
+		header.ms.push_back(elapsed_ms(start));
+		headerbytes = headerstrm.str().size();
+
+		std::ostringstream implstrm;
+		start = std::chrono::steady_clock::now();
+		gen.generate_document_implementation("benchmark", implstrm);
+		implementation.ms.push_back(elapsed_ms(start));
+		implementationbytes = implstrm.str().size();
+	}
+
+	if (!opts.keepschema) {
+		std::remove(opts.schemafile.c_str());
+	}
+
+	cout << "{" << endl;
+	cout << "\t\"tables\": " << opts.tables << "," << endl;
+	cout << "\t\"fields\": " << opts.fields << "," << endl;
+	cout << "\t\"fk_density\": " << opts.fkdensity << "," << endl;
+	cout << "\t\"fk_depth\": " << opts.fkdepth << "," << endl;
+	cout << "\t\"iterations\": " << opts.iterations << "," << endl;
+	cout << "\t\"seed\": " << opts.seed << "," << endl;
+	cout << "\t\"header_bytes\": " << headerbytes << "," << endl;
+	cout << "\t\"implementation_bytes\": " << implementationbytes << "," << endl;
+	cout << "\t\"phases\": {" << endl;
+	write_phase(parse, cout);
+	cout << "," << endl;
+	write_phase(sort, cout);
+	cout << "," << endl;
+	write_phase(header, cout);
+	cout << "," << endl;
+	write_phase(implementation, cout);
+	cout << endl << "\t}," << endl;
+	cout << "\t\"peak_memory_kb\": " << peak_memory_kb() << endl;
+	cout << "}" << endl;
+	return 0;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+// minimal stand-in for the dbgenpp run time library, sufficient to link and
+// run the code generated from runtime_benchmark.dbgen. table_notify_callback
+// unpacks the trigger arguments into the generated row structs the same way
+// the run time library does, and forwards the event to an event_sink passed
+// as user data to create_callbacks().
+
+namespace dbgenpp {
+
+inline void read_value(sqlite3_value* value, int& result) {
+	result = sqlite3_value_int(value);
+}
+
+inline void read_value(sqlite3_value* value, double& result) {
+	result = sqlite3_value_double(value);
+}
+
+inline void read_value(sqlite3_value* value, std::string& result) {
+	const unsigned char* text = sqlite3_value_text(value);
+	if (text)
+		result.assign((const char*)text, sqlite3_value_bytes(value));
+	else
+		result.clear();
+}
+
+inline void read_value(sqlite3_value* value, std::vector<unsigned char>& result) {
+	const unsigned char* blob = (const unsigned char*)sqlite3_value_blob(value);
+	result.assign(blob, blob + sqlite3_value_bytes(value));
+}
+
+template <typename T>
+struct read_column {
+	T& data;
+	sqlite3_value** row;
+	int& index;
+
+	read_column(T& _data, sqlite3_value** _row, int& _index) : data(_data), row(_row), index(_index) {}
+
+	template <typename C>
+	void operator()(C) {
+		read_value(row[index], data.*C::member());
+		index++;
+	}
+};
+
+// reads only the columns whose bit is set in changed. unchanged columns are
+// passed as null by the update trigger and left value initialized.
+template <typename T>
+struct read_changed_column {
+	T& data;
+	sqlite3_value** row;
+	int& index;
+	unsigned long long changed;
+
+	read_changed_column(T& _data, sqlite3_value** _row, int& _index, unsigned long long _changed) : data(_data), row(_row), index(_index), changed(_changed) {}
+
+	template <typename C>
+	void operator()(C) {
+		if (changed & C::changed_bit())
+			read_value(row[index], data.*C::member());
+		index++;
+	}
+};
+
+template <typename T>
+void read_row(T& data, sqlite3_value** row, int& index) {
+	boost::mpl::for_each<typename T::column_members>(read_column<T>(data, row, index));
+}
+
+template <typename T>
+void read_changed_row(T& data, sqlite3_value** row, int& index, unsigned long long changed) {
+	boost::mpl::for_each<typename T::column_members>(read_changed_column<T>(data, row, index, changed));
+}
+
+template <typename EVT>
+struct event_sink {
+	virtual ~event_sink() {}
+	virtual bool notify(EVT& ev) = 0;
+};
+
+// sends a bulk session summary. tables generated without "bulk_sessions"
+// have no bulk() event and pick the overload rejecting the notification.
+template <typename T, typename EVT>
+bool notify_bulk(event_sink<EVT>* sink, sqlite3_value** row, decltype(&T::table_traits::bulk)) {
+	EVT ev = EVT();
+	ev.type = T::table_traits::bulk();
+	ev.bulk.inserted = sqlite3_value_int(row[1]);
+	ev.bulk.updated = sqlite3_value_int(row[2]);
+	ev.bulk.deleted = sqlite3_value_int(row[3]);
+	return sink->notify(ev);
+}
+
+template <typename T, typename EVT>
+bool notify_bulk(event_sink<EVT>*, sqlite3_value**, ...) {
+	return false;
+}
+
+// row[0] is the notification type as emitted by create_triggers():
+// 0 = after insert, 1 = after delete, 2 = after update (new row, then old
+// row), 3 = after update with the changed_columns option (new row, the mask
+// of changed columns, then the old values of the changed columns),
+// 10/11/12 = before insert/delete/update, 20 = bulk session summary with
+// the inserted, updated and deleted row counts.
+template <typename T, typename EVT>
+bool table_notify_callback(sqlite3_context* ctx, sqlite3_value** row) {
+	event_sink<EVT>* sink = (event_sink<EVT>*)sqlite3_user_data(ctx);
+	int type = sqlite3_value_int(row[0]);
+
+	if (type == 20)
+		return notify_bulk<T, EVT>(sink, row, 0);
+
+	T newdata;
+	T olddata = T();
+	EVT ev;
+	int index = 1;
+	read_row(newdata, row, index);
+	ev.id = sqlite3_value_int(row[1]);
+	ev.newdata = newdata;
+	ev.changed = 0;
+
+	switch (type) {
+		case 0:
+			ev.type = T::table_traits::after_insert();
+			break;
+		case 1:
+			ev.type = T::table_traits::after_delete();
+			break;
+		case 2:
+			ev.type = T::table_traits::after_update();
+			ev.changed = ~0ULL;
+			read_row(olddata, row, index);
+			ev.olddata = olddata;
+			break;
+		case 3:
+			ev.type = T::table_traits::after_update();
+			ev.changed = (unsigned long long)sqlite3_value_int64(row[index]);
+			index++;
+			read_changed_row(olddata, row, index, ev.changed);
+			ev.olddata = olddata;
+			break;
+		case 10:
+			ev.type = T::table_traits::before_insert();
+			break;
+		case 11:
+			ev.type = T::table_traits::before_delete();
+			break;
+		case 12:
+			ev.type = T::table_traits::before_update();
+			break;
+		default:
+			return false;
+	}
+	return sink->notify(ev);
+}
+
+}
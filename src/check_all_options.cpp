@@ -0,0 +1,134 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include <boost/mpl/vector.hpp>
+#include <boost/mpl/for_each.hpp>
+
+using std::cerr;
+using std::endl;
+
+#ifdef CHECK_ALL_OPTIONS_SESSION
+#include "check_all_options_session_types.h"
+#include "benchmark_runtime.h"
+#include "check_all_options_session_types_cpp.h"
+#else
+#include "check_all_options_types.h"
+#include "benchmark_runtime.h"
+#include "check_all_options_types_cpp.h"
+#endif
+
+// compiles the code generated for check_all_options.dbgen, which enables the
+// options the benchmark schemas leave off and has a table keyed by text with
+// a text foreign key, and runs a few writes through its triggers.
+// check_all_options_session.dbgen imports the same tables with persistent
+// triggers and session undo, which cannot be combined with undo_dedup_bytes.
+
+struct check_sink : dbgenpp::event_sink<document_event_data> {
+	int events;
+
+	check_sink() : events(0) {}
+	bool notify(document_event_data&) {
+		events++;
+		return true;
+	}
+};
+
+static std::vector<std::string> undoqueries;
+static bool recording = true;
+
+extern "C" void undoredo_add_query(sqlite3_context* ctx, int, sqlite3_value** argv) {
+	const char* query = (const char*)sqlite3_value_text(argv[0]);
+	undoqueries.push_back(query ? query : "");
+	sqlite3_result_int(ctx, 1);
+}
+
+extern "C" void undoredo_enabled_callback(sqlite3_context* ctx, int, sqlite3_value**) {
+	sqlite3_result_int(ctx, recording ? 1 : 0);
+}
+
+static bool exec(sqlite3* db, const char* sql) {
+	char* error = 0;
+	if (sqlite3_exec(db, sql, 0, 0, &error) == SQLITE_OK)
+		return true;
+	cerr << sql << ": " << (error ? error : "error") << endl;
+	sqlite3_free(error);
+	return false;
+}
+
+static int count_rows(sqlite3* db, const char* table) {
+	std::string query = std::string("select count(*) from ") + table + ";";
+	sqlite3_stmt* stmt = 0;
+	int result = -1;
+	if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, 0) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+		result = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+// the tag note is long enough to be deduplicated in the undo queries, and
+// deleting the tag cascades through the text foreign key of album
+static const char writes[] =
+	"insert into tag values ('rock', 'a note which is long enough to be stored once in the undo value store');"
+	"insert into artist values (1, 'artist', x'0102');"
+	"insert into album values (1, 1, 'rock', 'first album');"
+	"update tag set note = note || '!' where name = 'rock';"
+	"update album set title = 'renamed album' where id = 1;"
+	"delete from tag where name = 'rock';";
+
+static bool check_writes(sqlite3* db) {
+	check_sink sink;
+	create_callbacks(db, &sink);
+#ifdef CHECK_ALL_OPTIONS_SESSION
+	if (!exec(db, tables_script) || !install_triggers(db))
+		return false;
+	undo_history* history = open_undo_history(db);
+	if (!history || !exec(db, writes) || !commit_undo_step(history) || !apply_undo(history)) {
+		cerr << "session undo failed" << endl;
+		close_undo_history(history);
+		return false;
+	}
+	close_undo_history(history);
+#else
+	if (!exec(db, tables_script) || !exec(db, triggers_script) || !exec(db, writes))
+		return false;
+	recording = false;
+	for (size_t i = undoqueries.size(); i-- > 0; ) {
+		if (!exec(db, undoqueries[i].c_str()))
+			return false;
+	}
+	for (size_t i = 0; i < undoqueries.size(); i++) {
+		release_undo_values(db, undoqueries[i].c_str());
+	}
+	if (undo_value_bytes(db) != 0) {
+		cerr << "undo values left after releasing every undo query" << endl;
+		return false;
+	}
+#endif
+	if (count_rows(db, "tag") != 0 || count_rows(db, "artist") != 0 || count_rows(db, "album") != 0) {
+		cerr << "undo did not restore the empty tables" << endl;
+		return false;
+	}
+	if (sink.events == 0) {
+		cerr << "no notify callbacks" << endl;
+		return false;
+	}
+	return true;
+}
+
+int main() {
+	sqlite3* db = 0;
+	if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+		cerr << "cannot open database" << endl;
+		return 1;
+	}
+	sqlite3_create_function(db, "undoredo_add_query", 1, SQLITE_ANY, 0, undoredo_add_query, 0, 0);
+	sqlite3_create_function(db, "undoredo_enabled_callback", 0, SQLITE_ANY, 0, undoredo_enabled_callback, 0, 0);
+	bool result = check_writes(db);
+	sqlite3_close(db);
+
+	query_plan_report report;
+	if (!verify_query_plans(cerr, &report))
+		return report.failures > 0 ? 4 : 3;
+	return result ? 0 : 1;
+}
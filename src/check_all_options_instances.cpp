@@ -0,0 +1,15 @@
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include <boost/mpl/vector.hpp>
+#include <boost/mpl/for_each.hpp>
+
+#include "check_all_options_session_types.h"
+#include "benchmark_runtime.h"
+
+// check_all_options_session.dbgen enables "extern_templates" and
+// "instances_per_table", so the run time templates used by its notify
+// callbacks are instantiated here, one unit per table
+#include "check_all_options_session_instances_tag_cpp.h"
+#include "check_all_options_session_instances_artist_cpp.h"
+#include "check_all_options_session_instances_album_cpp.h"
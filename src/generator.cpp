@@ -3,6 +3,7 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include "generator.h"
 
 using std::endl;
@@ -10,21 +11,52 @@ using std::cerr;
 using std::string;
 using std::stringstream;
 
-string sqlite_type_to_cpp_type(int type) {
+// pmr selects the allocator aware std::pmr containers for text and blob
+string sqlite_type_to_cpp_type(int type, bool pmr = false) {
 	switch (type) {
 		case dbgen_integer:
 			return "int";
 		case dbgen_text:
-			return "std::string";
+			return pmr ? "std::pmr::string" : "std::string";
 		case dbgen_float:
 			return "double"; // SQLITE_FLOAT is a 64-bit double.
 		case dbgen_blob:
-			return "std::vector<unsigned char>";
+			return pmr ? "std::pmr::vector<unsigned char>" : "std::vector<unsigned char>";
 		default:
 			return "";
 	}
 }
 
+string cpp_escape(const string& text) {
+	string result;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '"' || text[i] == '\\') result += '\\';
+		result += text[i];
+	}
+	return result;
+}
+
+void sqlscript::statement(const string& sql) {
+	literal << "\t\"" << cpp_escape(sql) << "\\n\"" << endl;
+	text += sql + "\n";
+}
+
+void sqlscript::comment(const string& comment) {
+	literal << "\t// " << comment << endl;
+}
+
+void sqlscript::blank() {
+	literal << endl;
+}
+
+// writes the script as adjacent string literals, which the compiler
+// concatenates into a single constant
+void sqlscript::write(std::ostream& strm) {
+	if (text.empty())
+		strm << "\t\"\"" << endl;
+	strm << literal.str();
+}
+
 void generate_class_header_event(tableinfo& tabinfo, std::ostream& strm) {
 	std::string tablename = tabinfo.tablename + "data";
 	strm << "struct " << tablename << " {" << endl;
@@ -37,7 +69,346 @@ void generate_class_header_event(tableinfo& tabinfo, std::ostream& strm) {
 	strm << "};" << endl << endl;
 }
 
-void generate_class_header(tableinfo& tabinfo, std::ostream& strm) {
+unsigned long long fnv1a(const char* data, size_t size) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+unsigned long long fnv1a(const string& text) {
+	return fnv1a(text.data(), text.size());
+}
+
+// returns the bit for a column in the changed column mask of update events.
+// columns past the 63rd share the last bit.
+size_t changed_bit(size_t index) {
+	return index < 63 ? index : 63;
+}
+
+// returns the index of the primary key field, or of the field named "id"
+// which the undo triggers assume when no field is marked primary
+size_t primary_key_index(tableinfo& tabinfo) {
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].primarykey) return i;
+	}
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].fieldname == "id") return i;
+	}
+	return 0;
+}
+
+bool has_primary_key(tableinfo& tabinfo) {
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].primarykey) return true;
+	}
+	return false;
+}
+
+// the conflict target of an upsert must be a declared key
+bool upsert_table(tableinfo& tabinfo) {
+	return tabinfo.shardkey.empty() && has_primary_key(tabinfo);
+}
+
+struct statementtexts {
+	string select;
+	string select_all;
+	string insert;
+	string update;
+	string remove;
+	string upsert;
+};
+
+// returns the single record statements on table, which is the table name
+// optionally qualified with a schema. the parameter ?N always refers to the
+// column at index N - 1 in column_members, so the same bindings work for
+// every statement.
+statementtexts statement_texts(tableinfo& tabinfo, const string& table) {
+	size_t key = primary_key_index(tabinfo);
+	stringstream columns, parameters, assignments, keyparam, excluded;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		fieldinfo& finfo = tabinfo.fields[i];
+		if (i > 0) columns << ", ";
+		columns << finfo.fieldname;
+		if (i > 0) parameters << ", ";
+		parameters << "?" << (i + 1);
+		if (i != key) {
+			if (!assignments.str().empty()) assignments << ", ";
+			assignments << finfo.fieldname << " = ?" << (i + 1);
+			if (!excluded.str().empty()) excluded << ", ";
+			excluded << finfo.fieldname << " = excluded." << finfo.fieldname;
+		}
+	}
+	if (assignments.str().empty())
+		assignments << tabinfo.fields[key].fieldname << " = ?" << (key + 1);
+	keyparam << tabinfo.fields[key].fieldname << " = ?" << (key + 1);
+
+	statementtexts result;
+	result.select = "select " + columns.str() + " from " + table + " where " + keyparam.str() + ";";
+	result.select_all = "select " + columns.str() + " from " + table + ";";
+	result.insert = "insert into " + table + " (" + columns.str() + ") values (" + parameters.str() + ");";
+	result.update = "update " + table + " set " + assignments.str() + " where " + keyparam.str() + ";";
+	result.remove = "delete from " + table + " where " + keyparam.str() + ";";
+	if (excluded.str().empty())
+		result.upsert = result.insert.substr(0, result.insert.size() - 1) + " on conflict(" + tabinfo.fields[key].fieldname + ") do nothing;";
+	else
+		result.upsert = result.insert.substr(0, result.insert.size() - 1) + " on conflict(" + tabinfo.fields[key].fieldname + ") do update set " + excluded.str() + ";";
+	return result;
+}
+
+void generate_statement_traits(tableinfo& tabinfo, bool upsert, std::ostream& strm) {
+	statementtexts texts = statement_texts(tabinfo, tabinfo.tablename);
+	strm << "		enum { column_count = " << tabinfo.fields.size() << ", key_parameter = " << (primary_key_index(tabinfo) + 1) << " };" << endl;
+	strm << "		static DBGENPP_CONSTEXPR const char* select_query() { return \"" << texts.select << "\"; }" << endl;
+	strm << "		static DBGENPP_CONSTEXPR const char* select_all_query() { return \"" << texts.select_all << "\"; }" << endl;
+	strm << "		static DBGENPP_CONSTEXPR const char* insert_query() { return \"" << texts.insert << "\"; }" << endl;
+	strm << "		static DBGENPP_CONSTEXPR const char* update_query() { return \"" << texts.update << "\"; }" << endl;
+	strm << "		static DBGENPP_CONSTEXPR const char* delete_query() { return \"" << texts.remove << "\"; }" << endl;
+	if (upsert && upsert_table(tabinfo))
+		strm << "		static DBGENPP_CONSTEXPR const char* upsert_query() { return \"" << texts.upsert << "\"; }" << endl;
+}
+
+// generates the routing of a sharded table. rows go to the shard picked by
+// a fibonacci hash of the shard key, and each statement has one text per
+// shard schema.
+void generate_shard_traits(tableinfo& tabinfo, int shards, std::ostream& strm) {
+	std::vector<statementtexts> texts;
+	for (int i = 0; i < shards; i++) {
+		stringstream table;
+		table << "shard" << i << "." << tabinfo.tablename;
+		texts.push_back(statement_texts(tabinfo, table.str()));
+	}
+
+	strm << "		static int shard(int key) { return (int)((((unsigned long long)(unsigned int)key * 0x9E3779B97F4A7C15ULL) >> 32) % " << shards << "); }" << endl;
+	const char* names[] = { "shard_select_query", "shard_scan_query", "shard_insert_query", "shard_update_query", "shard_delete_query" };
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		strm << "		static const char* " << names[i] << "(int shard) {" << endl;
+		strm << "			static const char* queries[] = {" << endl;
+		for (int j = 0; j < shards; j++) {
+			statementtexts& t = texts[j];
+			const string* text[] = { &t.select, &t.select_all, &t.insert, &t.update, &t.remove };
+			strm << "				\"" << *text[i] << "\"," << endl;
+		}
+		strm << "			};" << endl;
+		strm << "			return queries[shard];" << endl;
+		strm << "		}" << endl;
+	}
+}
+
+string column_definitions(tableinfo& tabinfo) {
+	stringstream columns;
+	for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+		if (j > 0) columns << ", ";
+		fieldinfo& finfo = tabinfo.fields[j];
+		columns << finfo.fieldname << " ";
+		switch (finfo.type) {
+			case dbgen_integer:
+				columns << "integer";
+				break;
+			case dbgen_float:
+				columns << "real";
+				break;
+			case dbgen_text:
+				columns << "varchar(" << finfo.size << ")";
+				break;
+			case dbgen_blob:
+				columns << "blob";
+				break;
+		}
+		if (finfo.primarykey) columns << " primary key";
+		if (!finfo.keytable.empty()) columns << " references " << finfo.keytable << "(" << finfo.keyname << ")";
+	}
+	return columns.str();
+}
+
+string foreign_key_index_name(tableinfo& tabinfo, fieldinfo& finfo) {
+	return tabinfo.tablename + "_" + finfo.keytable + "_" + finfo.keyname + "_index";
+}
+
+// sharded tables have no triggers, so they get no notify callback either
+bool has_notify_callback(tableinfo& tabinfo) {
+	return tabinfo.shardkey.empty();
+}
+
+bool has_fulltext(tableinfo& tabinfo) {
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].fulltext) return true;
+	}
+	return false;
+}
+
+// returns the fulltext columns of a table, prefixed with qualifier
+string fulltext_columns(tableinfo& tabinfo, const string& qualifier) {
+	string result;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (!tabinfo.fields[i].fulltext) continue;
+		if (!result.empty()) result += ", ";
+		result += qualifier + tabinfo.fields[i].fieldname;
+	}
+	return result;
+}
+
+// the fts5 index is an external content table, which reads the indexed text
+// from the table itself and refers to rows by id
+string fulltext_table_definition(tableinfo& tabinfo) {
+	return "create virtual table " + tabinfo.tablename + "_fts using fts5(" + fulltext_columns(tabinfo, "") + ", content='" + tabinfo.tablename + "', content_rowid='id');";
+}
+
+// returns the id and the fulltext columns of row, or parameters in their
+// place when row is empty
+string fulltext_values(tableinfo& tabinfo, const string& row) {
+	string result = row.empty() ? "?" : row + ".id";
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (!tabinfo.fields[i].fulltext) continue;
+		result += ", " + (row.empty() ? string("?") : row + "." + tabinfo.fields[i].fieldname);
+	}
+	return result;
+}
+
+// the statements of the fts5 sync triggers adding and removing a row of the
+// index. prefix is prepended to the index name. row is the trigger's row
+// reference, or empty for the statements the query plan check prepares.
+string fulltext_insert_row(tableinfo& tabinfo, const string& prefix, const string& row) {
+	string fts = prefix + tabinfo.tablename + "_fts";
+	return "insert into " + fts + "(rowid, " + fulltext_columns(tabinfo, "") + ") values (" + fulltext_values(tabinfo, row) + ");";
+}
+
+string fulltext_delete_row(tableinfo& tabinfo, const string& prefix, const string& row) {
+	string fts = prefix + tabinfo.tablename + "_fts";
+	return "insert into " + fts + "(" + fts + ", rowid, " + fulltext_columns(tabinfo, "") + ") values ('delete', " + fulltext_values(tabinfo, row) + ");";
+}
+
+// returns the lines of the persistent triggers keeping the fts5 index in sync
+// with inserts, deletes and updates of the indexed columns. they are created
+// with the table, so writes from any connection update the index, also during
+// bulk sessions. prefix is prepended to the table, index and trigger names.
+std::vector<string> fulltext_triggers(tableinfo& tabinfo, const string& prefix) {
+	string table = prefix + tabinfo.tablename;
+	string insertrow = fulltext_insert_row(tabinfo, prefix, "new");
+	string deleterow = fulltext_delete_row(tabinfo, prefix, "old");
+	std::vector<string> result;
+	result.push_back("create trigger if not exists " + table + "_fts_insert_trigger after insert on " + table + " begin");
+	result.push_back(insertrow);
+	result.push_back("end;");
+	result.push_back("create trigger if not exists " + table + "_fts_delete_trigger after delete on " + table + " begin");
+	result.push_back(deleterow);
+	result.push_back("end;");
+	result.push_back("create trigger if not exists " + table + "_fts_update_trigger after update of id, " + fulltext_columns(tabinfo, "") + " on " + table + " begin");
+	result.push_back(deleterow);
+	result.push_back(insertrow);
+	result.push_back("end;");
+	return result;
+}
+
+string drop_fulltext_triggers(tableinfo& tabinfo) {
+	return "drop trigger if exists " + tabinfo.tablename + "_fts_insert_trigger;\n"
+		"drop trigger if exists " + tabinfo.tablename + "_fts_delete_trigger;\n"
+		"drop trigger if exists " + tabinfo.tablename + "_fts_update_trigger;\n";
+}
+
+// generates the statements reading the sqlite3_value* expression value into
+// the member expression target
+void generate_read_value(fieldinfo& finfo, const string& target, const string& value, const string& indent, std::ostream& strm) {
+	switch (finfo.type) {
+		case dbgen_integer:
+			strm << indent << target << " = sqlite3_value_int(" << value << ");" << endl;
+			break;
+		case dbgen_float:
+			strm << indent << target << " = sqlite3_value_double(" << value << ");" << endl;
+			break;
+		case dbgen_text:
+			strm << indent << "if (const unsigned char* text = sqlite3_value_text(" << value << "))" << endl;
+			strm << indent << "\t" << target << ".assign((const char*)text, sqlite3_value_bytes(" << value << "));" << endl;
+			strm << indent << "else" << endl;
+			strm << indent << "\t" << target << ".clear();" << endl;
+			break;
+		case dbgen_blob:
+			strm << indent << "if (const unsigned char* blob = (const unsigned char*)sqlite3_value_blob(" << value << "))" << endl;
+			strm << indent << "\t" << target << ".assign(blob, blob + sqlite3_value_bytes(" << value << "));" << endl;
+			strm << indent << "else" << endl;
+			strm << indent << "\t" << target << ".clear();" << endl;
+			break;
+	}
+}
+
+// generates the statements binding the member expression value to the
+// statement parameter, where destructor is the sqlite destructor expression
+// of text and blobs
+void generate_bind_value(fieldinfo& finfo, size_t parameter, const string& value, const string& destructor, const string& indent, std::ostream& strm) {
+	switch (finfo.type) {
+		case dbgen_integer:
+			strm << indent << "sqlite3_bind_int(stmt, " << parameter << ", " << value << ");" << endl;
+			break;
+		case dbgen_float:
+			strm << indent << "sqlite3_bind_double(stmt, " << parameter << ", " << value << ");" << endl;
+			break;
+		case dbgen_text:
+			strm << indent << "sqlite3_bind_text(stmt, " << parameter << ", " << value << ".c_str(), (int)" << value << ".size(), " << destructor << ");" << endl;
+			break;
+		case dbgen_blob:
+			strm << indent << "if (" << value << ".empty())" << endl;
+			strm << indent << "\tsqlite3_bind_zeroblob(stmt, " << parameter << ", 0);" << endl;
+			strm << indent << "else" << endl;
+			strm << indent << "\tsqlite3_bind_blob(stmt, " << parameter << ", &" << value << ".front(), (int)" << value << ".size(), " << destructor << ");" << endl;
+			break;
+	}
+}
+
+// generates straight-line conversions between a table struct and statement
+// parameters, result columns or trigger callback arguments. text and blobs
+// are copied by sqlite unless copy is false, in which case they are bound
+// with SQLITE_STATIC and the bound data must outlive the step.
+void generate_marshal_functions(tableinfo& tabinfo, std::ostream& strm) {
+	bool copied = false;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].type == dbgen_text || tabinfo.fields[i].type == dbgen_blob) copied = true;
+	}
+	strm << "void bind_" << tabinfo.tablename << "(sqlite3_stmt* stmt, const " << tabinfo.tablename << "data& data, bool " << (copied ? "copy" : "/*copy*/") << ") {" << endl;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		fieldinfo& finfo = tabinfo.fields[i];
+		generate_bind_value(finfo, i + 1, "data." + finfo.fieldname, "copy ? SQLITE_TRANSIENT : SQLITE_STATIC", "\t", strm);
+	}
+	strm << "}" << endl << endl;
+
+	strm << "void read_" << tabinfo.tablename << "(sqlite3_stmt* stmt, " << tabinfo.tablename << "data& data) {" << endl;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		fieldinfo& finfo = tabinfo.fields[i];
+		switch (finfo.type) {
+			case dbgen_integer:
+				strm << "\tdata." << finfo.fieldname << " = sqlite3_column_int(stmt, " << i << ");" << endl;
+				break;
+			case dbgen_float:
+				strm << "\tdata." << finfo.fieldname << " = sqlite3_column_double(stmt, " << i << ");" << endl;
+				break;
+			case dbgen_text:
+				strm << "\tif (const unsigned char* text = sqlite3_column_text(stmt, " << i << "))" << endl;
+				strm << "\t\tdata." << finfo.fieldname << ".assign((const char*)text, sqlite3_column_bytes(stmt, " << i << "));" << endl;
+				strm << "\telse" << endl;
+				strm << "\t\tdata." << finfo.fieldname << ".clear();" << endl;
+				break;
+			case dbgen_blob:
+				strm << "\tif (const unsigned char* blob = (const unsigned char*)sqlite3_column_blob(stmt, " << i << "))" << endl;
+				strm << "\t\tdata." << finfo.fieldname << ".assign(blob, blob + sqlite3_column_bytes(stmt, " << i << "));" << endl;
+				strm << "\telse" << endl;
+				strm << "\t\tdata." << finfo.fieldname << ".clear();" << endl;
+				break;
+		}
+	}
+	strm << "}" << endl << endl;
+
+	strm << "void read_" << tabinfo.tablename << "(sqlite3_value** values, " << tabinfo.tablename << "data& data) {" << endl;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		fieldinfo& finfo = tabinfo.fields[i];
+		stringstream value;
+		value << "values[" << i << "]";
+		generate_read_value(finfo, "data." + finfo.fieldname, value.str(), "\t", strm);
+	}
+	strm << "}" << endl << endl;
+}
+
+void generate_class_header(tableinfo& tabinfo, bool bulk, int shards, bool arena, bool upsert, std::ostream& strm) {
 	std::string tablename = tabinfo.tablename + "data";
 	strm << "struct " << tablename << " {" << endl;
 
@@ -49,6 +420,11 @@ void generate_class_header(tableinfo& tabinfo, std::ostream& strm) {
 	strm << "\t\tstatic int after_update() { return event_type_update_" << tabinfo.tablename << "; }" << endl;
 	strm << "\t\tstatic int before_delete() { return event_type_before_delete_" << tabinfo.tablename << "; }" << endl;
 	strm << "\t\tstatic int after_delete() { return event_type_delete_" << tabinfo.tablename << "; }" << endl;
+	if (bulk)
+		strm << "\t\tstatic int bulk() { return event_type_bulk_" << tabinfo.tablename << "; }" << endl;
+	generate_statement_traits(tabinfo, upsert, strm);
+	if (!tabinfo.shardkey.empty())
+		generate_shard_traits(tabinfo, shards, strm);
 	strm << "\t};" << endl;
 
 	// generate metadata column traits
@@ -58,9 +434,10 @@ void generate_class_header(tableinfo& tabinfo, std::ostream& strm) {
 		strm << "\t\tstatic const char* name() { return \"" << finfo.fieldname << "\"; }" << endl;
 		strm << "\t\tstatic const char* keytable() { return \"" << finfo.keytable << "\"; }" << endl;
 		strm << "\t\tstatic const char* keyname() { return \"" << finfo.keyname << "\"; }" << endl;
-		strm << "\t\ttypedef " << sqlite_type_to_cpp_type(finfo.type) << " type;" << endl;
-		strm << "\t\tenum { is_primary = " << (finfo.primarykey?"true":"false") << ", is_nullable = " << (finfo.nullable?"true":"false") << " };" << endl;
+		strm << "\t\ttypedef " << sqlite_type_to_cpp_type(finfo.type, arena) << " type;" << endl;
+		strm << "\t\tenum { is_primary = " << (finfo.primarykey?"true":"false") << ", is_nullable = " << (finfo.nullable?"true":"false") << ", column_index = " << i << " };" << endl;
 		strm << "\t\tstatic type " << tablename << "::*member() { return &" << tablename << "::" << finfo.fieldname << "; };" << endl;
+		strm << "\t\tstatic unsigned long long changed_bit() { return 1ULL << " << changed_bit(i) << "; }" << endl;
 		strm << "\t};" << endl;
 	}
 
@@ -79,13 +456,69 @@ void generate_class_header(tableinfo& tabinfo, std::ostream& strm) {
 		fieldinfo& finfo = tabinfo.fields[i];
 		strm << "\t_" << finfo.fieldname << "::type " << finfo.fieldname << ";" << endl;
 	}
+
+	// text and blob members take their allocator from the constructor, and
+	// copies use the default memory resource
+	if (arena) {
+		strm << endl;
+		strm << "\ttypedef std::pmr::polymorphic_allocator<char> allocator_type;" << endl << endl;
+		bool allocates = false;
+		for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+			allocates |= tabinfo.fields[i].type == dbgen_text || tabinfo.fields[i].type == dbgen_blob;
+		}
+		strm << "\t" << tablename << "() = default;" << endl;
+		strm << "\texplicit " << tablename << "(const allocator_type&" << (allocates ? " alloc" : "") << ")" << endl;
+		for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+			fieldinfo& finfo = tabinfo.fields[i];
+			bool allocated = finfo.type == dbgen_text || finfo.type == dbgen_blob;
+			strm << "\t\t" << (i == 0 ? ": " : ", ") << finfo.fieldname << "(" << (allocated ? "alloc" : "") << ")" << endl;
+		}
+		strm << "\t{}" << endl;
+	}
 	strm << "};" << endl << endl;
 }
 
+// all options are off by default
+documentgen::documentgen()
+	: generate_instrumentation(false)
+	, generate_changed_columns(false)
+	, generate_persistent_triggers(false)
+	, generate_bulk_sessions(false)
+	, generate_reader_pool(false)
+	, generate_navigation(false)
+	, generate_virtual_tables(false)
+	, generate_session_undo(false)
+	, generate_row_arena(false)
+	, generate_query_plan_check(false)
+	, generate_upsert(false)
+	, generate_cursors(false)
+	, generate_extern_templates(false)
+	, generate_instances_per_table(false)
+	, undo_dedup_bytes(0)
+	, shard_count(4)
+{
+}
+
 void documentgen::generate_document_header(const std::string& prefix, std::ostream& strm) {
 	strm << "#pragma once" << endl << endl;
 	strm << "// (automatically generated)" << endl << endl;
 
+	// the statement texts are constant expressions wherever the compiler
+	// supports constexpr, and plain functions returning literals otherwise
+	strm << "#ifndef DBGENPP_CONSTEXPR" << endl;
+	strm << "#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)" << endl;
+	strm << "#define DBGENPP_CONSTEXPR constexpr" << endl;
+	strm << "#else" << endl;
+	strm << "#define DBGENPP_CONSTEXPR" << endl;
+	strm << "#endif" << endl;
+	strm << "#endif" << endl << endl;
+
+	if (generate_row_arena)
+		strm << "#include <memory_resource>" << endl << endl;
+
+	if (generate_upsert)
+		strm << "#include <map>" << endl << endl;
+
 	strm << "enum {" << endl;
 	for (size_t i = 0; i < tables.size(); i++) {
 		strm << "\tevent_type_before_insert_" << tables[i].tablename << ", " << endl;
@@ -96,6 +529,9 @@ void documentgen::generate_document_header(const std::string& prefix, std::ostre
 
 		strm << "\tevent_type_before_update_" << tables[i].tablename << ", " << endl;
 		strm << "\tevent_type_update_" << tables[i].tablename << ", " << endl;
+
+		if (generate_bulk_sessions)
+			strm << "\tevent_type_bulk_" << tables[i].tablename << ", " << endl;
 	}
 	strm << endl;
 
@@ -107,7 +543,7 @@ void documentgen::generate_document_header(const std::string& prefix, std::ostre
 	strm << endl;
 
 	for (size_t i = 0; i < tables.size(); i++) {
-		generate_class_header(tables[i], strm);
+		generate_class_header(tables[i], generate_bulk_sessions, shard_count, generate_row_arena, generate_upsert, strm);
 	}
 
 	strm << "typedef boost::mpl::vector<" << endl;
@@ -147,136 +583,3028 @@ void documentgen::generate_document_header(const std::string& prefix, std::ostre
 	}
 	strm << "};" << endl << endl;
 
+	if (generate_bulk_sessions) {
+		strm << "struct bulk_summary {" << endl;
+		strm << "\tint inserted;" << endl;
+		strm << "\tint updated;" << endl;
+		strm << "\tint deleted;" << endl;
+		strm << "};" << endl << endl;
+	}
+
 	strm << "struct document_event_data {" << endl;
 	strm << "\tint type;" << endl;
 	strm << "\tint id;" << endl;
 	strm << "\ttableunion newdata;" << endl;
 	strm << "\ttableunion olddata;" << endl;
+	strm << "\tunsigned long long changed; // changed column bits of update events" << endl;
+	if (generate_bulk_sessions)
+		strm << "\tbulk_summary bulk; // row counts of bulk session events" << endl;
 
 	strm << "};" << endl << endl;
 
+	strm << "struct sqlite3_stmt;" << endl;
+	strm << "struct sqlite3_value;" << endl;
+	strm << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		strm << "void bind_" << tabinfo.tablename << "(sqlite3_stmt* stmt, const " << tabinfo.tablename << "data& data, bool copy = true);" << endl;
+		strm << "void read_" << tabinfo.tablename << "(sqlite3_stmt* stmt, " << tabinfo.tablename << "data& data);" << endl;
+		strm << "void read_" << tabinfo.tablename << "(sqlite3_value** values, " << tabinfo.tablename << "data& data);" << endl;
+	}
+	strm << endl;
+
+	// found by the unqualified read_value() calls of the run time templates,
+	// since this header is included before the run time library headers
+	if (generate_row_arena) {
+		strm << "namespace dbgenpp {" << endl;
+		strm << "void read_value(sqlite3_value* value, std::pmr::string& result);" << endl;
+		strm << "void read_value(sqlite3_value* value, std::pmr::vector<unsigned char>& result);" << endl;
+		strm << "}" << endl << endl;
+	}
+
+	if (generate_instrumentation)
+		generate_stats_header(strm);
+
+	if (generate_bulk_sessions)
+		generate_bulk_session_header(strm);
+
+	if (generate_reader_pool)
+		generate_reader_pool_header(strm);
+
+	if (has_sharded_tables())
+		generate_shards_header(strm);
+
+	if (has_snapshot_tables())
+		generate_snapshot_header(strm);
+
+	if (generate_navigation)
+		generate_navigation_header(strm);
+
+	if (generate_virtual_tables)
+		generate_virtual_tables_header(strm);
+
+	if (generate_session_undo)
+		generate_session_undo_header(strm);
+
+	if (undo_dedup_bytes > 0)
+		generate_undo_values_header(strm);
+
+	if (generate_upsert)
+		generate_upsert_header(strm);
+
+	if (generate_cursors)
+		generate_cursors_header(strm);
+
+	if (has_fulltext_tables())
+		generate_fulltext_header(strm);
+
+	if (generate_query_plan_check)
+		generate_query_plan_check_header(strm);
+}
+
+// the notify callbacks of row arena documents instantiate
+// dbgenpp::table_notify_callback with row types local to <prefix>_types_cpp.h
+bool documentgen::uses_notify_template() {
+	if (generate_row_arena)
+		return false;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (has_notify_callback(tables[i])) return true;
+	}
+	return false;
 }
 
+string notify_template_instance(tableinfo& tabinfo) {
+	return "bool dbgenpp::table_notify_callback<" + tabinfo.tablename + "data, document_event_data>(sqlite3_context* ctx, sqlite3_value** row);";
+}
 
-void documentgen::generate_document_implementation(const std::string& prefix, std::ostream& strm) {
+// declares the run time template instances used by the generated callbacks
+// as extern, so the translation unit including <prefix>_types_cpp.h does not
+// instantiate them. they are instantiated once in the instantiation units,
+// which can be compiled in parallel. the template itself is declared by the
+// run time library headers, which are included before <prefix>_types_cpp.h.
+void documentgen::generate_extern_template_declarations(const std::string& prefix, std::ostream& strm) {
+	if (!uses_notify_template())
+		return;
+
+	if (generate_instances_per_table)
+		strm << "// instantiated in " << prefix << "_instances_<table>_cpp.h" << endl;
+	else
+		strm << "// instantiated in " << prefix << "_instances_cpp.h" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (has_notify_callback(tables[i]))
+			strm << "extern template " << notify_template_instance(tables[i]) << endl;
+	}
+	strm << endl;
+}
+
+// writes the explicit instantiations for one table, or for all tables when
+// tabinfo is null. the unit is included in a single source file after
+// <prefix>_types.h and the dbgenpp run time headers.
+void documentgen::generate_instantiation_unit(const std::string& prefix, tableinfo* tabinfo, std::ostream& strm) {
 	strm << "// (automatically generated)" << endl << endl;
+	strm << "// explicit instantiations of the templates declared extern in " << prefix << "_types_cpp.h" << endl << endl;
+
+	if (!uses_notify_template())
+		return;
 
-	// generate functions which are used as trigger callbacks
 	for (size_t i = 0; i < tables.size(); i++) {
-		tableinfo& tabinfo = tables[i];
-		strm << "extern \"C\" void " << tables[i].tablename << "_notify_callback(sqlite3_context* ctx, int, sqlite3_value** row) {" << endl;
-		strm << "\tbool result = dbgenpp::table_notify_callback<" << tables[i].tablename << "data, document_event_data>(ctx, row);" << endl;
-		strm << "\tsqlite3_result_int(ctx, result?1:0);" << endl;
-		strm << "}" << endl;
-		strm << endl;
+		if ((tabinfo == 0 || tabinfo == &tables[i]) && has_notify_callback(tables[i]))
+			strm << "template " << notify_template_instance(tables[i]) << endl;
 	}
+}
 
-	// generate a function which generates a query that generates tables in an empty database
-	strm << "void create_tables(std::ostream& query, const char* prefix) {" << endl;
 
+// adds the undo trigger statements recording undoquery, an sql expression
+// evaluating to the inverse query. with instrumentation enabled, the size of
+// the recorded query is also counted by <table>_undo_stats, which passes the
+// query through, where statsevent is the stats_event_* index of the undone
+// operation. guard is prepended to the where clause. undoquery is evaluated
+// once and only after the where clause passed, so undo value references are
+// only taken for queries which are recorded. the record of their references
+// gets its row in dbgenpp_undo_records from the same trigger, so it is rolled
+// back together with the statement.
+void documentgen::add_undo_statements(sqlscript& script, tableinfo& tabinfo, const string& undoquery, const string& statsevent, const string& guard) {
+	string query = undo_dedup_bytes > 0 ? "dbgenpp_undo_query(" + undoquery + ")" : undoquery;
+	if (generate_instrumentation)
+		query = tabinfo.tablename + "_undo_stats(" + statsevent + ", " + query + ")";
+	script.statement("select undoredo_add_query(" + query + ") where " + guard + "undoredo_enabled_callback() = 1;");
+	if (undo_dedup_bytes > 0)
+		script.statement("insert into dbgenpp_undo_records select dbgenpp_undo_recorded() where dbgenpp_undo_pending() = 1;");
+}
+
+void documentgen::generate_stats_header(std::ostream& strm) {
+	strm << "enum {" << endl;
+	strm << "\tstats_event_insert," << endl;
+	strm << "\tstats_event_delete," << endl;
+	strm << "\tstats_event_update," << endl;
+	strm << "\tstats_event_before_insert," << endl;
+	strm << "\tstats_event_before_delete," << endl;
+	strm << "\tstats_event_before_update," << endl;
+	strm << "\tstats_event_bulk," << endl;
+	strm << "\tstats_event_count" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "struct table_event_stats {" << endl;
+	strm << "\tunsigned long long invocations;" << endl;
+	strm << "\tunsigned long long total_ns;" << endl;
+	strm << "\tunsigned long long max_ns;" << endl;
+	strm << "\tunsigned long long rows;" << endl;
+	strm << "\tunsigned long long undo_records;" << endl;
+	strm << "\tunsigned long long undo_bytes;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "struct table_stats {" << endl;
+	strm << "\ttable_event_stats events[stats_event_count];" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "struct document_stats {" << endl;
 	for (size_t i = 0; i < tables.size(); i++) {
-		tableinfo& tabinfo = tables[i];
-		strm << "\tquery << \"create table \" << prefix << \"" << tabinfo.tablename << " (";
-		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
-			if (j > 0) strm << ", ";
-			fieldinfo& finfo = tabinfo.fields[j];
-			strm << finfo.fieldname << " ";
-			switch (finfo.type) {
-				case dbgen_integer:
-					strm << "integer";
-					break;
-				case dbgen_float:
-					strm << "real";
-					break;
-				case dbgen_text:
-					strm << "varchar(" << finfo.size << ")";
-					break;
-				case dbgen_blob:
-					strm << "blob";
-					break;
-			}
-			if (finfo.primarykey) strm << " primary key";
-			if (!finfo.keytable.empty()) strm << " references " << finfo.keytable << "(" << finfo.keyname << ")";
-		}
-		strm << ");\" << endl;" << endl;
+		strm << "\ttable_stats " << tables[i].tablename << ";" << endl;
+	}
+	strm << "};" << endl << endl;
 
-		// create indexes for foreign keys to prevent full table scans during enforcing
-		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
-			fieldinfo& finfo = tabinfo.fields[j];
-			if (finfo.keytable.empty()) {
-				continue;
-			}
-			std::string indexname = tabinfo.tablename + "_" + finfo.keytable + "_" + finfo.keyname + "_index";
-			strm << "\tquery << \"create index \" << prefix << \"" << indexname << " ON ";
-			strm << tabinfo.tablename << "(" << finfo.fieldname << ");\" << endl;" << endl;
-		}
+	strm << "document_stats get_stats();" << endl;
+	strm << "void reset_stats();" << endl;
+	strm << "void dump_stats(std::ostream& strm);" << endl << endl;
+}
+
+void documentgen::generate_stats_implementation(std::ostream& strm) {
+	strm << "#include <atomic>" << endl;
+	strm << "#include <chrono>" << endl << endl;
+
+	strm << "struct table_event_counters {" << endl;
+	strm << "\tstd::atomic<unsigned long long> invocations;" << endl;
+	strm << "\tstd::atomic<unsigned long long> total_ns;" << endl;
+	strm << "\tstd::atomic<unsigned long long> max_ns;" << endl;
+	strm << "\tstd::atomic<unsigned long long> rows;" << endl;
+	strm << "\tstd::atomic<unsigned long long> undo_records;" << endl;
+	strm << "\tstd::atomic<unsigned long long> undo_bytes;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "struct table_counters {" << endl;
+	strm << "\ttable_event_counters events[stats_event_count];" << endl;
+	strm << "};" << endl << endl;
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		strm << "table_counters " << tables[i].tablename << "_counters;" << endl;
 	}
+	strm << endl;
+
+	// the notification type passed from the triggers is 0..2 for after and
+	// 10..12 for before events, in the same order as stats_event_*. after
+	// updates with changed_columns are passed as 3 and bulk session
+	// summaries as 20. updates carry the new and the old row.
+	strm << "struct stats_scope {" << endl;
+	strm << "\ttable_event_counters& counters;" << endl;
+	strm << "\tstd::chrono::steady_clock::time_point start;" << endl << endl;
+	strm << "\tstats_scope(table_counters& table, int type)" << endl;
+	strm << "\t\t: counters(table.events[type == 3 ? stats_event_update : type < 10 ? type : type < 20 ? type - 10 + stats_event_before_insert : stats_event_bulk])" << endl;
+	strm << "\t\t, start(std::chrono::steady_clock::now())" << endl;
+	strm << "\t{" << endl;
+	strm << "\t\tcounters.invocations.fetch_add(1, std::memory_order_relaxed);" << endl;
+	strm << "\t\tcounters.rows.fetch_add(type == 2 || type == 3 ? 2 : 1, std::memory_order_relaxed);" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\t~stats_scope() {" << endl;
+	strm << "\t\tunsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();" << endl;
+	strm << "\t\tcounters.total_ns.fetch_add(ns, std::memory_order_relaxed);" << endl;
+	strm << "\t\tunsigned long long max_ns = counters.max_ns.load(std::memory_order_relaxed);" << endl;
+	strm << "\t\twhile (ns > max_ns && !counters.max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) {}" << endl;
+	strm << "\t}" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "void get_table_stats(table_counters& counters, table_stats& result) {" << endl;
+	strm << "\tfor (int i = 0; i < stats_event_count; i++) {" << endl;
+	strm << "\t\tresult.events[i].invocations = counters.events[i].invocations.load(std::memory_order_relaxed);" << endl;
+	strm << "\t\tresult.events[i].total_ns = counters.events[i].total_ns.load(std::memory_order_relaxed);" << endl;
+	strm << "\t\tresult.events[i].max_ns = counters.events[i].max_ns.load(std::memory_order_relaxed);" << endl;
+	strm << "\t\tresult.events[i].rows = counters.events[i].rows.load(std::memory_order_relaxed);" << endl;
+	strm << "\t\tresult.events[i].undo_records = counters.events[i].undo_records.load(std::memory_order_relaxed);" << endl;
+	strm << "\t\tresult.events[i].undo_bytes = counters.events[i].undo_bytes.load(std::memory_order_relaxed);" << endl;
+	strm << "\t}" << endl;
 	strm << "}" << endl << endl;
 
-	strm << "void create_callbacks(sqlite3* db, void* self) {" << endl;
+	strm << "document_stats get_stats() {" << endl;
+	strm << "\tdocument_stats result;" << endl;
 	for (size_t i = 0; i < tables.size(); i++) {
-		tableinfo& tabinfo = tables[i];
-		strm << "\tsqlite3_create_function(db, \"" << tabinfo.tablename << "_notify_callback\", -1, SQLITE_ANY, self, " << tabinfo.tablename << "_notify_callback, 0, 0);" << endl;
+		strm << "\tget_table_stats(" << tables[i].tablename << "_counters, result." << tables[i].tablename << ");" << endl;
 	}
+	strm << "\treturn result;" << endl;
 	strm << "}" << endl << endl;
 
-	strm << "void create_triggers(sqlite3* db, std::ostream& query) {" << endl;
+	strm << "void reset_table_stats(table_counters& counters) {" << endl;
+	strm << "\tfor (int i = 0; i < stats_event_count; i++) {" << endl;
+	strm << "\t\tcounters.events[i].invocations.store(0, std::memory_order_relaxed);" << endl;
+	strm << "\t\tcounters.events[i].total_ns.store(0, std::memory_order_relaxed);" << endl;
+	strm << "\t\tcounters.events[i].max_ns.store(0, std::memory_order_relaxed);" << endl;
+	strm << "\t\tcounters.events[i].rows.store(0, std::memory_order_relaxed);" << endl;
+	strm << "\t\tcounters.events[i].undo_records.store(0, std::memory_order_relaxed);" << endl;
+	strm << "\t\tcounters.events[i].undo_bytes.store(0, std::memory_order_relaxed);" << endl;
+	strm << "\t}" << endl;
+	strm << "}" << endl << endl;
 
+	strm << "void reset_stats() {" << endl;
 	for (size_t i = 0; i < tables.size(); i++) {
-		tableinfo& tabinfo = tables[i];
-		strm << "\t// " << tabinfo.tablename << ":" << endl;
-
-		stringstream newfieldsquery, oldfieldsquery, updatefieldsquery, oldfieldsnoquotequery;
-		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
-			fieldinfo& fi = tabinfo.fields[j];
-			if (j > 0) newfieldsquery << ", ";
-			newfieldsquery << "new." << fi.fieldname;
+		strm << "\treset_table_stats(" << tables[i].tablename << "_counters);" << endl;
+	}
+	strm << "}" << endl << endl;
 
-			if (j > 0) oldfieldsquery << ", ";
-			oldfieldsquery << "'||quote(old." << fi.fieldname << ")||'";
+	strm << "void dump_table_stats(std::ostream& strm, const char* tablename, const table_stats& stats) {" << endl;
+	strm << "\tstatic const char* eventnames[] = { \"insert\", \"delete\", \"update\", \"before_insert\", \"before_delete\", \"before_update\", \"bulk\" };" << endl;
+	strm << "\tfor (int i = 0; i < stats_event_count; i++) {" << endl;
+	strm << "\t\tconst table_event_stats& ev = stats.events[i];" << endl;
+	strm << "\t\tif (ev.invocations == 0 && ev.undo_records == 0) continue;" << endl;
+	strm << "\t\tstrm << tablename << \" \" << eventnames[i];" << endl;
+	strm << "\t\tstrm << \" invocations=\" << ev.invocations << \" total_ns=\" << ev.total_ns << \" max_ns=\" << ev.max_ns;" << endl;
+	strm << "\t\tstrm << \" rows=\" << ev.rows << \" undo_records=\" << ev.undo_records << \" undo_bytes=\" << ev.undo_bytes << std::endl;" << endl;
+	strm << "\t}" << endl;
+	strm << "}" << endl << endl;
 
-			if (j > 0) oldfieldsnoquotequery << ", ";
-			oldfieldsnoquotequery << "old." << fi.fieldname;
+	strm << "void dump_stats(std::ostream& strm) {" << endl;
+	strm << "\tdocument_stats stats = get_stats();" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		strm << "\tdump_table_stats(strm, \"" << tables[i].tablename << "\", stats." << tables[i].tablename << ");" << endl;
+	}
+	strm << "}" << endl << endl;
+}
 
-			if (j > 0) updatefieldsquery << ", ";
-			updatefieldsquery << fi.fieldname << " = '||quote(old." << fi.fieldname << ")||'";
-		}
+void documentgen::generate_bulk_session_header(std::ostream& strm) {
+	strm << "struct bulk_session {" << endl;
+	strm << "\tbool undo; // whether end_bulk_session() records an undo query" << endl;
+	strm << "\tbulk_summary tables[" << tables.size() << "];" << endl;
+	strm << "\tvoid (*update_hook)(void*, int, const char*, const char*, long long); // update hook of the connection before the session" << endl;
+	strm << "\tvoid* update_hook_user;" << endl;
+	strm << "};" << endl << endl;
 
-		// generate before insert trigger:
-		if (tabinfo.generate_before_insert) {
-			strm << "\tquery << \"create temp trigger " << tabinfo.tablename << "_before_insert_trigger before insert on " << tabinfo.tablename << " begin\" << endl;" << endl;
-			strm << "\tquery << \"select raise(abort, 'before insert failed from callback constraint') where " << tabinfo.tablename << "_notify_callback(10, " << newfieldsquery.str() << ") = 0;\" << endl;" << endl;
-			strm << "\tquery << \"end;\" << endl;" << endl << endl;
-		}
+	strm << "struct sqlite3;" << endl;
+	strm << "bool begin_bulk_session(sqlite3* db, bulk_session& session, void (*update_hook)(void*, int, const char*, const char*, long long) = 0);" << endl;
+	strm << "bool end_bulk_session(sqlite3* db, bulk_session& session);" << endl << endl;
+}
 
-		// generate after insert trigger:
-		if (tabinfo.generate_after_insert || tabinfo.generate_undo) {
-			strm << "\tquery << \"create temp trigger " << tabinfo.tablename << "_insert_notify_trigger after insert on " << tabinfo.tablename << " begin\" << endl;" << endl;
-			if (tabinfo.generate_undo)
-				strm << "\tquery << \"select undoredo_add_query('delete from " << tabinfo.tablename << " where id = '||quote(new.id)||';') where undoredo_enabled_callback() = 1;\" << endl;" << endl;
-			if (tabinfo.generate_after_insert) {
-				strm << "\tquery << \"select raise(abort, 'after insert failed from callback constraint') where " << tabinfo.tablename << "_notify_callback(0, " << newfieldsquery.str() << ") = 0;\" << endl;" << endl;
+// returns the tables which are undone by a bulk session when the table at
+// index is: the table itself and the tables reached from it through
+// cascading foreign keys, as deleting its rows on undo deletes theirs too
+std::vector<size_t> documentgen::bulk_snapshot_tables(size_t index) {
+	std::vector<bool> reached(tables.size(), false);
+	reached[index] = true;
+	// tables are in topological order, so children follow their parents
+	for (size_t i = index + 1; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		for (size_t j = 0; j < tabinfo.fields.size() && !reached[i]; j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			if (finfo.keytable.empty() || !finfo.cascade) continue;
+			for (size_t k = index; k < i; k++) {
+				if (reached[k] && tables[k].tablename == finfo.keytable)
+					reached[i] = true;
 			}
-			strm << "\tquery << \"end;\" << endl;" << endl << endl;
 		}
+	}
+	std::vector<size_t> result;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (reached[i] && undo_triggers(tables[i]))
+			result.push_back(i);
+	}
+	return result;
+}
 
-		// generate before delete trigger:
-		int cascadecount = 0;
-		for (size_t j = 0; j < tables.size(); j++) {
-			tableinfo& otabinfo = tables[j];
-			for (size_t i = 0; i < otabinfo.fields.size(); i++) {	
-				fieldinfo& finfo = otabinfo.fields[i];
-				if (finfo.keytable == tabinfo.tablename && finfo.cascade) {
-					cascadecount ++;
-				}
+void documentgen::generate_bulk_session_implementation(std::ostream& strm) {
+	// with undo, the rows of a table are copied to temp.<table>_bulk_snapshot
+	// by a temp trigger before its first change in the session, so tables
+	// which are not changed are not copied. dbgenpp_bulk_snapshot_tables
+	// lists the copied tables.
+	sqlscript createscript, dropscript;
+	createscript.statement("create temp table dbgenpp_bulk_snapshot_tables (tableindex integer primary key);");
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!undo_triggers(tabinfo)) continue;
+		createscript.statement("create temp table " + tabinfo.tablename + "_bulk_snapshot as select * from " + tabinfo.tablename + " where 0;");
+	}
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!undo_triggers(tabinfo)) continue;
+		std::vector<size_t> snapshots = bulk_snapshot_tables(i);
+		const char* operations[] = { "insert", "update", "delete" };
+		for (int j = 0; j < 3; j++) {
+			stringstream trigger;
+			trigger << "create temp trigger " << tabinfo.tablename << "_bulk_snapshot_" << operations[j] << " before " << operations[j] << " on " << tabinfo.tablename;
+			trigger << " when not exists (select 1 from dbgenpp_bulk_snapshot_tables where tableindex = " << i << ") begin";
+			createscript.statement(trigger.str());
+			for (size_t k = 0; k < snapshots.size(); k++) {
+				stringstream copy;
+				copy << "insert into " << tables[snapshots[k]].tablename << "_bulk_snapshot select * from " << tables[snapshots[k]].tablename;
+				copy << " where not exists (select 1 from dbgenpp_bulk_snapshot_tables where tableindex = " << snapshots[k] << ");";
+				createscript.statement(copy.str());
+				add_query_plan_text(copy.str(), tables[snapshots[k]].tablename);
+				stringstream mark;
+				mark << "insert or ignore into dbgenpp_bulk_snapshot_tables values (" << snapshots[k] << ");";
+				createscript.statement(mark.str());
 			}
+			createscript.statement("end;");
+			dropscript.statement("drop trigger if exists temp." + tabinfo.tablename + "_bulk_snapshot_" + operations[j] + ";");
 		}
-
-		if (cascadecount > 0 || tabinfo.generate_before_delete || tabinfo.generate_undo) {
-			strm << "\tquery << \"create temp trigger " << tabinfo.tablename << "_delete_notify_trigger before delete on " << tabinfo.tablename << " begin\" << endl;" << endl;
+	}
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (!undo_triggers(tables[i])) continue;
+		dropscript.statement("drop table if exists temp." + tables[i].tablename + "_bulk_snapshot;");
+	}
+	dropscript.statement("drop table if exists temp.dbgenpp_bulk_snapshot_tables;");
+
+	strm << "const char create_bulk_snapshots_script[] =" << endl;
+	createscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "const char drop_bulk_snapshots_script[] =" << endl;
+	dropscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "int bulk_table_index(const char* tablename) {" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		strm << "\tif (strcmp(tablename, \"" << tables[i].tablename << "\") == 0) return " << i << ";" << endl;
+	}
+	strm << "\treturn -1;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// counts the changed rows, and passes every change on to the update hook" << endl;
+	strm << "// the connection had before the session" << endl;
+	strm << "extern \"C\" void bulk_session_update_hook(void* user, int op, const char* dbname, const char* tablename, sqlite3_int64 rowid) {" << endl;
+	strm << "\tbulk_session* session = (bulk_session*)user;" << endl;
+	strm << "\tif (session->update_hook)" << endl;
+	strm << "\t\tsession->update_hook(session->update_hook_user, op, dbname, tablename, rowid);" << endl;
+	strm << "\tint index = bulk_table_index(tablename);" << endl;
+	strm << "\tif (index == -1) return;" << endl;
+	strm << "\tbulk_summary& summary = session->tables[index];" << endl;
+	strm << "\tif (op == SQLITE_INSERT)" << endl;
+	strm << "\t\tsummary.inserted++;" << endl;
+	strm << "\telse if (op == SQLITE_UPDATE)" << endl;
+	strm << "\t\tsummary.updated++;" << endl;
+	strm << "\telse if (op == SQLITE_DELETE)" << endl;
+	strm << "\t\tsummary.deleted++;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool bulk_session_exec(sqlite3* db, const std::string& query) {" << endl;
+	strm << "\treturn sqlite3_exec(db, query.c_str(), 0, 0, 0) == SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// suspends the notify and undo triggers until end_bulk_session(). the" << endl;
+	strm << "// changed rows are counted through the connection's update hook, which is" << endl;
+	strm << "// restored by end_bulk_session(). sqlite3_update_hook() only returns the" << endl;
+	strm << "// user data of the previous hook, so a hook installed by the caller must" << endl;
+	strm << "// be passed as update_hook to keep receiving changes during the session." << endl;
+	strm << "// if undo is enabled, the snapshot triggers are created." << endl;
+	strm << "bool begin_bulk_session(sqlite3* db, bulk_session& session, void (*update_hook)(void*, int, const char*, const char*, long long)) {" << endl;
+	strm << "\tmemset(&session, 0, sizeof(session));" << endl << endl;
+	bool undotables = false;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (undo_triggers(tables[i])) undotables = true;
+	}
+	if (undotables) {
+		strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+		strm << "\tif (sqlite3_prepare_v2(db, \"select undoredo_enabled_callback();\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+		strm << "\t\tsession.undo = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 1;" << endl;
+		strm << "\t\tsqlite3_finalize(stmt);" << endl;
+		strm << "\t}" << endl << endl;
+	}
+	strm << "\t// a session which was never ended may have left its snapshots behind" << endl;
+	strm << "\tif (session.undo && (!bulk_session_exec(db, drop_bulk_snapshots_script) || !bulk_session_exec(db, create_bulk_snapshots_script))) {" << endl;
+	strm << "\t\tbulk_session_exec(db, drop_bulk_snapshots_script);" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (!bulk_session_exec(db, \"select dbgenpp_bulk_session(1);\")) {" << endl;
+	strm << "\t\tif (session.undo)" << endl;
+	strm << "\t\t\tbulk_session_exec(db, drop_bulk_snapshots_script);" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsession.update_hook = update_hook;" << endl;
+	strm << "\tsession.update_hook_user = sqlite3_update_hook(db, bulk_session_update_hook, &session);" << endl;
+	strm << "\treturn true;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// resumes the per-row triggers, records the snapshots of the changed tables" << endl;
+	strm << "// as a single undo query restoring them and drops the snapshots, and sends" << endl;
+	strm << "// one summary event per changed table to the notify callbacks." << endl;
+	strm << "bool end_bulk_session(sqlite3* db, bulk_session& session) {" << endl;
+	strm << "\tsqlite3_update_hook(db, session.update_hook, session.update_hook_user);" << endl;
+	strm << "\tbool result = bulk_session_exec(db, \"select dbgenpp_bulk_session(0);\");" << endl << endl;
+
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tstd::string undoquery;" << endl;
+	// with session_undo there are no undo triggers, and the session records
+	// the bulk changes itself
+	if (undotables) {
+		strm << "\tif (session.undo) {" << endl;
+		strm << "\t\tbool restore[" << tables.size() << "] = { false };" << endl;
+		std::string snapshottables = "select tableindex from temp.dbgenpp_bulk_snapshot_tables;";
+		add_query_plan_text(snapshottables, "temp.dbgenpp_bulk_snapshot_tables");
+		strm << "\t\tif (sqlite3_prepare_v2(db, \"" << snapshottables << "\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+		strm << "\t\t\twhile (sqlite3_step(stmt) == SQLITE_ROW)" << endl;
+		strm << "\t\t\t\trestore[sqlite3_column_int(stmt, 0)] = true;" << endl;
+		strm << "\t\t\tsqlite3_finalize(stmt);" << endl;
+		strm << "\t\t} else" << endl;
+		strm << "\t\t\tresult = false;" << endl << endl;
+
+		// children are deleted before and inserted after their parents. the
+		// snapshot rows are inlined as quoted values, so the undo query does not
+		// depend on the snapshot tables.
+		for (size_t i = tables.size(); i-- > 0; ) {
+			if (!undo_triggers(tables[i])) continue;
+			strm << "\t\tif (restore[" << i << "]) undoquery += \"delete from " << tables[i].tablename << ";\";" << endl;
+		}
+		for (size_t i = 0; i < tables.size(); i++) {
+			tableinfo& tabinfo = tables[i];
+			if (!undo_triggers(tabinfo)) continue;
+			stringstream values;
+			for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+				if (j > 0) values << "||', '||";
+				values << "quote(" << tabinfo.fields[j].fieldname << ")";
+			}
+			std::string snapshot = "select group_concat('('||" + values.str() + "||')', ', ') from temp." + tabinfo.tablename + "_bulk_snapshot;";
+			add_query_plan_text(snapshot, "temp." + tabinfo.tablename + "_bulk_snapshot");
+			strm << "\t\tif (restore[" << i << "] && sqlite3_prepare_v2(db, \"" << cpp_escape(snapshot) << "\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+			strm << "\t\t\tif (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)" << endl;
+			strm << "\t\t\t\tundoquery += \"insert into " << tabinfo.tablename << " values \" + std::string((const char*)sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0)) + \";\";" << endl;
+			strm << "\t\t\tsqlite3_finalize(stmt);" << endl;
+			strm << "\t\t}" << endl;
+		}
+		strm << "\t\tresult &= bulk_session_exec(db, drop_bulk_snapshots_script);" << endl;
+		strm << "\t}" << endl << endl;
+	}
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!tabinfo.generate_after_insert && !tabinfo.generate_after_update && !tabinfo.generate_after_delete)
+			continue;
+		strm << "\tif (session.tables[" << i << "].inserted || session.tables[" << i << "].updated || session.tables[" << i << "].deleted) {" << endl;
+		strm << "\t\tif (sqlite3_prepare_v2(db, \"select " << tabinfo.tablename << "_notify_callback(20, ?1, ?2, ?3);\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+		strm << "\t\t\tsqlite3_bind_int(stmt, 1, session.tables[" << i << "].inserted);" << endl;
+		strm << "\t\t\tsqlite3_bind_int(stmt, 2, session.tables[" << i << "].updated);" << endl;
+		strm << "\t\t\tsqlite3_bind_int(stmt, 3, session.tables[" << i << "].deleted);" << endl;
+		strm << "\t\t\tresult &= sqlite3_step(stmt) == SQLITE_ROW;" << endl;
+		strm << "\t\t\tsqlite3_finalize(stmt);" << endl;
+		strm << "\t\t} else" << endl;
+		strm << "\t\t\tresult = false;" << endl;
+		strm << "\t}" << endl;
+	}
+	strm << endl;
+
+	strm << "\tif (!undoquery.empty() && sqlite3_prepare_v2(db, \"select undoredo_add_query(?1);\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+	strm << "\t\tsqlite3_bind_text(stmt, 1, undoquery.c_str(), (int)undoquery.size(), SQLITE_STATIC);" << endl;
+	strm << "\t\tresult &= sqlite3_step(stmt) == SQLITE_ROW;" << endl;
+	strm << "\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+}
+
+void documentgen::generate_reader_pool_header(std::ostream& strm) {
+	strm << "struct sqlite3;" << endl;
+	strm << "struct reader_pool;" << endl << endl;
+
+	strm << "struct reader_connection {" << endl;
+	strm << "\tsqlite3* db;" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (tables[i].shardkey.empty())
+			strm << "\tsqlite3_stmt* select_" << tables[i].tablename << ";" << endl;
+	}
+	strm << "};" << endl << endl;
+
+	strm << "bool configure_connection(sqlite3* db);" << endl;
+	strm << "bool open_writer(const char* filename, void* self, sqlite3** result);" << endl;
+	strm << "reader_pool* open_reader_pool(const char* filename, int count);" << endl;
+	strm << "void close_reader_pool(reader_pool* pool);" << endl;
+	strm << "reader_connection* acquire_reader(reader_pool* pool);" << endl;
+	strm << "void release_reader(reader_pool* pool, reader_connection* reader);" << endl << endl;
+}
+
+void documentgen::generate_reader_pool_implementation(std::ostream& strm) {
+	strm << "// settings shared by the writer and the reader connections: extended" << endl;
+	strm << "// result codes, a busy timeout instead of failing while another connection" << endl;
+	strm << "// checkpoints, synchronous = normal which is durable enough in wal mode," << endl;
+	strm << "// and temp tables in memory" << endl;
+	strm << "bool configure_connection(sqlite3* db) {" << endl;
+	strm << "\treturn sqlite3_extended_result_codes(db, 1) == SQLITE_OK &&" << endl;
+	strm << "\t\tsqlite3_busy_timeout(db, 5000) == SQLITE_OK &&" << endl;
+	strm << "\t\tsqlite3_exec(db, \"pragma synchronous = normal; pragma temp_store = memory;\", 0, 0, 0) == SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool prepare_reader_statements(reader_connection* reader) {" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (!tables[i].shardkey.empty())
+			continue;
+		strm << "\tif (sqlite3_prepare_v2(reader->db, " << tables[i].tablename << "data::table_traits::select_query(), -1, &reader->select_" << tables[i].tablename << ", 0) != SQLITE_OK)" << endl;
+		strm << "\t\treturn false;" << endl;
+	}
+	strm << "\treturn true;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void close_reader(reader_connection* reader) {" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (tables[i].shardkey.empty())
+			strm << "\tsqlite3_finalize(reader->select_" << tables[i].tablename << ");" << endl;
+	}
+	strm << "\tsqlite3_close(reader->db);" << endl;
+	strm << "\tdelete reader;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool database_is_empty(sqlite3* db) {" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"select 1 from sqlite_master where type = 'table';\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tbool result = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// opens the connection which owns the callbacks and triggers, creates the" << endl;
+	strm << "// tables in an empty database, and switches the database to wal mode so" << endl;
+	strm << "// readers do not block on it" << endl;
+	strm << "bool open_writer(const char* filename, void* self, sqlite3** result) {" << endl;
+	strm << "\tsqlite3* db = 0;" << endl;
+	strm << "\tif (sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0) != SQLITE_OK || !configure_connection(db)) {" << endl;
+	strm << "\t\tsqlite3_close(db);" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\tcreate_callbacks(db, self);" << endl;
+	strm << "\tbool installed = sqlite3_exec(db, \"pragma journal_mode = wal;\", 0, 0, 0) == SQLITE_OK;" << endl;
+	strm << "\tif (installed && database_is_empty(db))" << endl;
+	strm << "\t\tinstalled = sqlite3_exec(db, tables_script, 0, 0, 0) == SQLITE_OK;" << endl;
+	if (generate_persistent_triggers)
+		strm << "\tinstalled = installed && install_triggers(db);" << endl;
+	else
+		strm << "\tinstalled = installed && sqlite3_exec(db, triggers_script, 0, 0, 0) == SQLITE_OK;" << endl;
+	strm << "\tif (!installed) {" << endl;
+	strm << "\t\tsqlite3_close(db);" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\t*result = db;" << endl;
+	strm << "\treturn true;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "struct reader_pool {" << endl;
+	strm << "\tstd::vector<reader_connection*> readers;" << endl;
+	strm << "\tstd::vector<reader_connection*> available;" << endl;
+	strm << "\tstd::mutex lock;" << endl;
+	strm << "\tstd::condition_variable released;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "// opens count read-only connections without callbacks or triggers. each" << endl;
+	strm << "// connection is used by one thread at a time, between acquire_reader()" << endl;
+	strm << "// and release_reader(). the database must already be in wal mode." << endl;
+	strm << "reader_pool* open_reader_pool(const char* filename, int count) {" << endl;
+	strm << "\treader_pool* pool = new reader_pool();" << endl;
+	strm << "\tfor (int i = 0; i < count; i++) {" << endl;
+	strm << "\t\treader_connection* reader = new reader_connection();" << endl;
+	strm << "\t\tpool->readers.push_back(reader);" << endl;
+	strm << "\t\tif (sqlite3_open_v2(filename, &reader->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, 0) != SQLITE_OK ||" << endl;
+	strm << "\t\t\t!configure_connection(reader->db) ||" << endl;
+	strm << "\t\t\tsqlite3_exec(reader->db, \"pragma query_only = 1;\", 0, 0, 0) != SQLITE_OK ||" << endl;
+	strm << "\t\t\t!prepare_reader_statements(reader)) {" << endl;
+	strm << "\t\t\tclose_reader_pool(pool);" << endl;
+	strm << "\t\t\treturn 0;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t}" << endl;
+	strm << "\tpool->available = pool->readers;" << endl;
+	strm << "\treturn pool;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void close_reader_pool(reader_pool* pool) {" << endl;
+	strm << "\tfor (size_t i = 0; i < pool->readers.size(); i++) {" << endl;
+	strm << "\t\tclose_reader(pool->readers[i]);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tdelete pool;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// waits until a reader is available" << endl;
+	strm << "reader_connection* acquire_reader(reader_pool* pool) {" << endl;
+	strm << "\tstd::unique_lock<std::mutex> lock(pool->lock);" << endl;
+	strm << "\twhile (pool->available.empty())" << endl;
+	strm << "\t\tpool->released.wait(lock);" << endl;
+	strm << "\treader_connection* reader = pool->available.back();" << endl;
+	strm << "\tpool->available.pop_back();" << endl;
+	strm << "\treturn reader;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void release_reader(reader_pool* pool, reader_connection* reader) {" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (tables[i].shardkey.empty())
+			strm << "\tsqlite3_reset(reader->select_" << tables[i].tablename << ");" << endl;
+	}
+	strm << "\tstd::lock_guard<std::mutex> lock(pool->lock);" << endl;
+	strm << "\tpool->available.push_back(reader);" << endl;
+	strm << "\tpool->released.notify_one();" << endl;
+	strm << "}" << endl << endl;
+}
+
+bool documentgen::has_sharded_tables() {
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (!tables[i].shardkey.empty()) return true;
+	}
+	return false;
+}
+
+// sharded tables live in the attached schemas shard0..shardN-1. statements
+// are prepared on first use and kept in shard_router::statements, with
+// shard_operation_count slots per shard for each sharded table.
+void documentgen::generate_shards_header(std::ostream& strm) {
+	int shardedtables = 0;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (!tables[i].shardkey.empty()) shardedtables++;
+	}
+
+	strm << "struct sqlite3;" << endl << endl;
+	strm << "enum { shard_count = " << shard_count << ", shard_operation_count = 5 };" << endl << endl;
+
+	strm << "struct shard_router {" << endl;
+	strm << "\tsqlite3* db;" << endl;
+	strm << "\tsqlite3_stmt* statements[" << (shardedtables * 5 * shard_count) << "];" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "bool attach_shards(sqlite3* db, const char* filename, shard_router& router);" << endl;
+	strm << "bool detach_shards(shard_router& router);" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (tabinfo.shardkey.empty())
+			continue;
+		std::string dataname = tabinfo.tablename + "data";
+		strm << "bool select_" << tabinfo.tablename << "(shard_router& router, int key, " << dataname << "& data);" << endl;
+		strm << "bool insert_" << tabinfo.tablename << "(shard_router& router, const " << dataname << "& data);" << endl;
+		strm << "bool update_" << tabinfo.tablename << "(shard_router& router, const " << dataname << "& data);" << endl;
+		strm << "bool delete_" << tabinfo.tablename << "(shard_router& router, int key);" << endl;
+		strm << "bool scan_" << tabinfo.tablename << "(shard_router& router, bool (*callback)(" << dataname << "& data, void* user), void* user);" << endl;
+	}
+	strm << endl;
+}
+
+void documentgen::generate_shards_implementation(std::ostream& strm) {
+	sqlscript shardsscript, dropviewsscript, detachscript;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (tabinfo.shardkey.empty())
+			continue;
+
+		stringstream view;
+		view << "create temp view if not exists " << tabinfo.tablename << " as ";
+		for (int j = 0; j < shard_count; j++) {
+			stringstream table;
+			table << "shard" << j << "." << tabinfo.tablename;
+			shardsscript.statement("create table if not exists " + table.str() + " (" + column_definitions(tabinfo) + ");");
+			// without the terminating semicolon
+			std::string select = statement_texts(tabinfo, table.str()).select_all;
+			if (j > 0) view << " union all ";
+			view << select.substr(0, select.size() - 1);
+		}
+		// the view shadows the table name for cross-shard reads
+		shardsscript.statement(view.str() + ";");
+		dropviewsscript.statement("drop view if exists temp." + tabinfo.tablename + ";");
+		detachscript.statement("drop view if exists temp." + tabinfo.tablename + ";");
+	}
+	for (int j = 0; j < shard_count; j++) {
+		stringstream detach;
+		detach << "detach database shard" << j << ";";
+		detachscript.statement(detach.str());
+	}
+
+	strm << "const char shards_script[] =" << endl;
+	shardsscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "const char drop_shard_views_script[] =" << endl;
+	dropviewsscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "const char detach_shards_script[] =" << endl;
+	detachscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "// attaches filename.0 .. filename.N-1 as shard0 .. shardN-1, creating the" << endl;
+	strm << "// files and the sharded tables as needed, and the views over all shards" << endl;
+	strm << "bool attach_shards(sqlite3* db, const char* filename, shard_router& router) {" << endl;
+	strm << "\trouter.db = db;" << endl;
+	strm << "\tfor (size_t i = 0; i < sizeof(router.statements) / sizeof(router.statements[0]); i++) {" << endl;
+	strm << "\t\trouter.statements[i] = 0;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tint attached = 0;" << endl;
+	strm << "\tfor (; attached < shard_count; attached++) {" << endl;
+	strm << "\t\tstd::stringstream shardfile, query;" << endl;
+	strm << "\t\tshardfile << filename << \".\" << attached;" << endl;
+	strm << "\t\tquery << \"attach database ?1 as shard\" << attached << \";\";" << endl;
+	strm << "\t\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\t\tif (sqlite3_prepare_v2(db, query.str().c_str(), -1, &stmt, 0) != SQLITE_OK) {" << endl;
+	strm << "\t\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t\t\tbreak;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t\tsqlite3_bind_text(stmt, 1, shardfile.str().c_str(), -1, SQLITE_TRANSIENT);" << endl;
+	strm << "\t\tint result = sqlite3_step(stmt);" << endl;
+	strm << "\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t\tif (result != SQLITE_DONE)" << endl;
+	strm << "\t\t\tbreak;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (attached == shard_count && sqlite3_exec(db, shards_script, 0, 0, 0) == SQLITE_OK)" << endl;
+	strm << "\t\treturn true;" << endl;
+	strm << "\t// undo a partial attach: drop the views that were created and detach" << endl;
+	strm << "\t// the shards attached so far, one at a time so a missing one is skipped" << endl;
+	strm << "\tsqlite3_exec(db, drop_shard_views_script, 0, 0, 0);" << endl;
+	strm << "\tfor (int i = 0; i < attached; i++) {" << endl;
+	strm << "\t\tstd::stringstream query;" << endl;
+	strm << "\t\tquery << \"detach database shard\" << i << \";\";" << endl;
+	strm << "\t\tsqlite3_exec(db, query.str().c_str(), 0, 0, 0);" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn false;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool detach_shards(shard_router& router) {" << endl;
+	strm << "\tfor (size_t i = 0; i < sizeof(router.statements) / sizeof(router.statements[0]); i++) {" << endl;
+	strm << "\t\tsqlite3_finalize(router.statements[i]);" << endl;
+	strm << "\t\trouter.statements[i] = 0;" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn sqlite3_exec(router.db, detach_shards_script, 0, 0, 0) == SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "sqlite3_stmt* shard_statement(shard_router& router, int index, const char* query) {" << endl;
+	strm << "\tsqlite3_stmt*& stmt = router.statements[index];" << endl;
+	strm << "\tif (stmt == 0 && sqlite3_prepare_v2(router.db, query, -1, &stmt, 0) != SQLITE_OK) {" << endl;
+	strm << "\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t\tstmt = 0;" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn stmt;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool step_shard_statement(sqlite3_stmt* stmt) {" << endl;
+	strm << "\tbool result = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_reset(stmt);" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	int slot = 0;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (tabinfo.shardkey.empty())
+			continue;
+		std::string dataname = tabinfo.tablename + "data";
+		std::string traits = dataname + "::table_traits::";
+		std::string key = tabinfo.shardkey;
+		stringstream base;
+		base << slot * 5 << " * shard_count";
+		slot++;
+
+		strm << "bool select_" << tabinfo.tablename << "(shard_router& router, int key, " << dataname << "& data) {" << endl;
+		strm << "\tint shard = " << traits << "shard(key);" << endl;
+		strm << "\tsqlite3_stmt* stmt = shard_statement(router, " << base.str() << " + shard, " << traits << "shard_select_query(shard));" << endl;
+		strm << "\tif (!stmt)" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tsqlite3_bind_int(stmt, " << traits << "key_parameter, key);" << endl;
+		strm << "\tbool result = sqlite3_step(stmt) == SQLITE_ROW;" << endl;
+		strm << "\tif (result)" << endl;
+		strm << "\t\tread_" << tabinfo.tablename << "(stmt, data);" << endl;
+		strm << "\tsqlite3_reset(stmt);" << endl;
+		strm << "\treturn result;" << endl;
+		strm << "}" << endl << endl;
+
+		const char* operations[] = { "insert", "update" };
+		for (int j = 0; j < 2; j++) {
+			strm << "bool " << operations[j] << "_" << tabinfo.tablename << "(shard_router& router, const " << dataname << "& data) {" << endl;
+			strm << "\tint shard = " << traits << "shard(data." << key << ");" << endl;
+			strm << "\tsqlite3_stmt* stmt = shard_statement(router, " << base.str() << " + " << (j + 2) << " * shard_count + shard, " << traits << "shard_" << operations[j] << "_query(shard));" << endl;
+			strm << "\tif (!stmt)" << endl;
+			strm << "\t\treturn false;" << endl;
+			strm << "\tbind_" << tabinfo.tablename << "(stmt, data, false);" << endl;
+			strm << "\treturn step_shard_statement(stmt);" << endl;
+			strm << "}" << endl << endl;
+		}
+
+		strm << "bool delete_" << tabinfo.tablename << "(shard_router& router, int key) {" << endl;
+		strm << "\tint shard = " << traits << "shard(key);" << endl;
+		strm << "\tsqlite3_stmt* stmt = shard_statement(router, " << base.str() << " + 4 * shard_count + shard, " << traits << "shard_delete_query(shard));" << endl;
+		strm << "\tif (!stmt)" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tsqlite3_bind_int(stmt, " << traits << "key_parameter, key);" << endl;
+		strm << "\treturn step_shard_statement(stmt);" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "// calls callback for each row of each shard until it returns false" << endl;
+		strm << "bool scan_" << tabinfo.tablename << "(shard_router& router, bool (*callback)(" << dataname << "& data, void* user), void* user) {" << endl;
+		strm << "\tfor (int shard = 0; shard < shard_count; shard++) {" << endl;
+		strm << "\t\tsqlite3_stmt* stmt = shard_statement(router, " << base.str() << " + shard_count + shard, " << traits << "shard_scan_query(shard));" << endl;
+		strm << "\t\tif (!stmt)" << endl;
+		strm << "\t\t\treturn false;" << endl;
+		strm << "\t\tint result;" << endl;
+		strm << "\t\twhile ((result = sqlite3_step(stmt)) == SQLITE_ROW) {" << endl;
+		strm << "\t\t\t" << dataname << " data;" << endl;
+		strm << "\t\t\tread_" << tabinfo.tablename << "(stmt, data);" << endl;
+		strm << "\t\t\tif (!callback(data, user)) {" << endl;
+		strm << "\t\t\t\tsqlite3_reset(stmt);" << endl;
+		strm << "\t\t\t\treturn true;" << endl;
+		strm << "\t\t\t}" << endl;
+		strm << "\t\t}" << endl;
+		strm << "\t\tsqlite3_reset(stmt);" << endl;
+		strm << "\t\tif (result != SQLITE_DONE)" << endl;
+		strm << "\t\t\treturn false;" << endl;
+		strm << "\t}" << endl;
+		strm << "\treturn true;" << endl;
+		strm << "}" << endl << endl;
+	}
+}
+
+bool documentgen::has_snapshot_tables() {
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (tables[i].generate_snapshot) return true;
+	}
+	return false;
+}
+
+// the snapshot starts with a snapshot_header and one snapshot_table_entry per
+// snapshot table. each table is stored as one fixed width array per column,
+// in key order, followed by a heap with the text and blob contents. text and
+// blob columns store a snapshot_span into the heap. every array and heap is
+// 8 byte aligned. numbers are stored in native byte order.
+void documentgen::generate_snapshot_header(std::ostream& strm) {
+	stringstream layout;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!tabinfo.generate_snapshot)
+			continue;
+		layout << tabinfo.tablename << "(";
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			layout << tabinfo.fields[j].fieldname << " " << tabinfo.fields[j].type << ",";
+		}
+		layout << primary_key_index(tabinfo) << ");";
+	}
+
+	strm << "struct sqlite3;" << endl << endl;
+	strm << "enum { snapshot_format_version = 2 };" << endl;
+	strm << "const unsigned long long snapshot_layout_hash = 0x" << std::hex << fnv1a(layout.str()) << std::dec << "ULL;" << endl << endl;
+
+	strm << "struct snapshot_header {" << endl;
+	strm << "\tchar magic[8];" << endl;
+	strm << "\tunsigned int version;" << endl;
+	strm << "\tunsigned int table_count;" << endl;
+	strm << "\tunsigned long long layout_hash;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "struct snapshot_table_entry {" << endl;
+	strm << "\tunsigned long long rows;" << endl;
+	strm << "\tunsigned long long columns_offset;" << endl;
+	strm << "\tunsigned long long heap_offset;" << endl;
+	strm << "\tunsigned long long heap_size;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "struct snapshot_span {" << endl;
+	strm << "\tunsigned long long offset;" << endl;
+	strm << "\tunsigned long long size;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "struct snapshot_file {" << endl;
+	strm << "\tconst unsigned char* data;" << endl;
+	strm << "\tunsigned long long size;" << endl;
+	strm << "\tvoid* mapping;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "inline size_t snapshot_align(size_t size) { return (size + 7) & ~(size_t)7; }" << endl << endl;
+
+	strm << "bool export_snapshot(sqlite3* db, const char* filename);" << endl;
+	strm << "bool open_snapshot(const char* filename, snapshot_file& file);" << endl;
+	strm << "void close_snapshot(snapshot_file& file);" << endl << endl;
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!tabinfo.generate_snapshot)
+			continue;
+		fieldinfo& key = tabinfo.fields[primary_key_index(tabinfo)];
+
+		strm << "// reads " << tabinfo.tablename << " directly from a mapped snapshot_file" << endl;
+		strm << "struct " << tabinfo.tablename << "_snapshot {" << endl;
+		strm << "\tsize_t rows;" << endl;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			switch (finfo.type) {
+				case dbgen_integer:
+					strm << "\tconst int* " << finfo.fieldname << ";" << endl;
+					break;
+				case dbgen_float:
+					strm << "\tconst double* " << finfo.fieldname << ";" << endl;
+					break;
+				case dbgen_text:
+				case dbgen_blob:
+					strm << "\tconst snapshot_span* " << finfo.fieldname << ";" << endl;
+					break;
+			}
+		}
+		strm << "\tconst unsigned char* heap;" << endl << endl;
+
+		strm << "\tbool open(const snapshot_file& file);" << endl;
+		strm << "\tvoid read(size_t row, " << tabinfo.tablename << "data& data) const;" << endl << endl;
+
+		strm << "\tsize_t size() const { return rows; }" << endl << endl;
+
+		strm << "\t// returns the row with the given key, or size() if there is none" << endl;
+		strm << "\tsize_t find(int key) const {" << endl;
+		strm << "\t\tsize_t first = 0, count = rows;" << endl;
+		strm << "\t\twhile (count > 0) {" << endl;
+		strm << "\t\t\tsize_t step = count / 2;" << endl;
+		strm << "\t\t\tif (" << key.fieldname << "[first + step] < key) {" << endl;
+		strm << "\t\t\t\tfirst += step + 1;" << endl;
+		strm << "\t\t\t\tcount -= step + 1;" << endl;
+		strm << "\t\t\t} else" << endl;
+		strm << "\t\t\t\tcount = step;" << endl;
+		strm << "\t\t}" << endl;
+		strm << "\t\treturn first < rows && " << key.fieldname << "[first] == key ? first : rows;" << endl;
+		strm << "\t}" << endl;
+
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			if (finfo.type != dbgen_text && finfo.type != dbgen_blob)
+				continue;
+			const char* datatype = finfo.type == dbgen_text ? "const char*" : "const unsigned char*";
+			strm << endl;
+			strm << "\t" << datatype << " " << finfo.fieldname << "_data(size_t row) const { return (" << datatype << ")(heap + (size_t)" << finfo.fieldname << "[row].offset); }" << endl;
+			strm << "\tsize_t " << finfo.fieldname << "_size(size_t row) const { return (size_t)" << finfo.fieldname << "[row].size; }" << endl;
+		}
+		strm << "};" << endl << endl;
+	}
+}
+
+void documentgen::generate_snapshot_implementation(std::ostream& strm) {
+	strm << "void snapshot_append(std::vector<unsigned char>& buffer, const void* data, size_t size) {" << endl;
+	strm << "\tbuffer.insert(buffer.end(), (const unsigned char*)data, (const unsigned char*)data + size);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void snapshot_pad(std::vector<unsigned char>& buffer) {" << endl;
+	strm << "\tbuffer.resize(snapshot_align(buffer.size()));" << endl;
+	strm << "}" << endl << endl;
+
+	int tablecount = 0;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!tabinfo.generate_snapshot)
+			continue;
+		std::string dataname = tabinfo.tablename + "data";
+		statementtexts texts = statement_texts(tabinfo, tabinfo.tablename);
+		std::string query = texts.select_all.substr(0, texts.select_all.size() - 1) + " order by " + tabinfo.fields[primary_key_index(tabinfo)].fieldname + ";";
+
+		strm << "bool snapshot_export_" << tabinfo.tablename << "(sqlite3* db, std::vector<unsigned char>& buffer, snapshot_table_entry& entry) {" << endl;
+		strm << "\tstd::vector<" << dataname << "> rows;" << endl;
+		strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+		strm << "\tif (sqlite3_prepare_v2(db, \"" << query << "\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tint result;" << endl;
+		strm << "\twhile ((result = sqlite3_step(stmt)) == SQLITE_ROW) {" << endl;
+		strm << "\t\trows.push_back(" << dataname << "());" << endl;
+		strm << "\t\tread_" << tabinfo.tablename << "(stmt, rows.back());" << endl;
+		strm << "\t}" << endl;
+		strm << "\tsqlite3_finalize(stmt);" << endl;
+		strm << "\tif (result != SQLITE_DONE)" << endl;
+		strm << "\t\treturn false;" << endl << endl;
+
+		strm << "\tstd::vector<unsigned char> heap;" << endl;
+		strm << "\tentry.rows = rows.size();" << endl;
+		strm << "\tentry.columns_offset = buffer.size();" << endl;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			strm << "\tfor (size_t i = 0; i < rows.size(); i++) {" << endl;
+			switch (finfo.type) {
+				case dbgen_integer:
+				case dbgen_float:
+					strm << "\t\tsnapshot_append(buffer, &rows[i]." << finfo.fieldname << ", sizeof(rows[i]." << finfo.fieldname << "));" << endl;
+					break;
+				case dbgen_text:
+				case dbgen_blob:
+					strm << "\t\tsnapshot_span span;" << endl;
+					strm << "\t\tspan.offset = heap.size();" << endl;
+					strm << "\t\tspan.size = rows[i]." << finfo.fieldname << ".size();" << endl;
+					strm << "\t\theap.insert(heap.end(), rows[i]." << finfo.fieldname << ".begin(), rows[i]." << finfo.fieldname << ".end());" << endl;
+					strm << "\t\tsnapshot_append(buffer, &span, sizeof(span));" << endl;
+					break;
+			}
+			strm << "\t}" << endl;
+			strm << "\tsnapshot_pad(buffer);" << endl;
+		}
+		strm << "\tentry.heap_offset = buffer.size();" << endl;
+		strm << "\tentry.heap_size = heap.size();" << endl;
+		strm << "\tbuffer.insert(buffer.end(), heap.begin(), heap.end());" << endl;
+		strm << "\tsnapshot_pad(buffer);" << endl;
+		strm << "\treturn true;" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "bool " << tabinfo.tablename << "_snapshot::open(const snapshot_file& file) {" << endl;
+		strm << "\tconst snapshot_table_entry& entry = ((const snapshot_table_entry*)(file.data + sizeof(snapshot_header)))[" << tablecount << "];" << endl;
+		strm << "\trows = (size_t)entry.rows;" << endl;
+		strm << "\tconst unsigned char* column = file.data + entry.columns_offset;" << endl;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			strm << "\t" << finfo.fieldname << " = (const " << (finfo.type == dbgen_integer ? "int" : finfo.type == dbgen_float ? "double" : "snapshot_span") << "*)column;" << endl;
+			strm << "\tcolumn += snapshot_align(rows * sizeof(*" << finfo.fieldname << "));" << endl;
+		}
+		strm << "\theap = file.data + entry.heap_offset;" << endl;
+		strm << "\treturn column <= heap;" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "void " << tabinfo.tablename << "_snapshot::read(size_t row, " << dataname << "& data) const {" << endl;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			if (finfo.type == dbgen_integer || finfo.type == dbgen_float)
+				strm << "\tdata." << finfo.fieldname << " = " << finfo.fieldname << "[row];" << endl;
+			else
+				strm << "\tdata." << finfo.fieldname << ".assign(" << finfo.fieldname << "_data(row), " << finfo.fieldname << "_data(row) + " << finfo.fieldname << "_size(row));" << endl;
+		}
+		strm << "}" << endl << endl;
+		tablecount++;
+	}
+
+	strm << "// writes the snapshot tables to filename, reading them in one transaction." << endl;
+	strm << "// the file is written under a temporary name and renamed into place, so" << endl;
+	strm << "// processes which mapped the previous snapshot keep reading it unchanged." << endl;
+	strm << "bool export_snapshot(sqlite3* db, const char* filename) {" << endl;
+	strm << "\tsnapshot_table_entry entries[" << tablecount << "];" << endl;
+	strm << "\tstd::vector<unsigned char> buffer(sizeof(snapshot_header) + sizeof(entries));" << endl;
+	strm << "\tbool result = sqlite3_exec(db, \"savepoint export_snapshot;\", 0, 0, 0) == SQLITE_OK;" << endl;
+	tablecount = 0;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (tables[i].generate_snapshot)
+			strm << "\tresult = result && snapshot_export_" << tables[i].tablename << "(db, buffer, entries[" << tablecount++ << "]);" << endl;
+	}
+	strm << "\tsqlite3_exec(db, \"release export_snapshot;\", 0, 0, 0);" << endl;
+	strm << "\tif (!result)" << endl;
+	strm << "\t\treturn false;" << endl << endl;
+	strm << "\tsnapshot_header header;" << endl;
+	strm << "\tmemcpy(header.magic, \"dbgensnp\", sizeof(header.magic));" << endl;
+	strm << "\theader.version = snapshot_format_version;" << endl;
+	strm << "\theader.table_count = " << tablecount << ";" << endl;
+	strm << "\theader.layout_hash = snapshot_layout_hash;" << endl;
+	strm << "\tmemcpy(&buffer[0], &header, sizeof(header));" << endl;
+	strm << "\tmemcpy(&buffer[sizeof(header)], entries, sizeof(entries));" << endl << endl;
+	strm << "\tchar suffix[32];" << endl;
+	strm << "#if defined(_WIN32)" << endl;
+	strm << "\tsnprintf(suffix, sizeof(suffix), \".%lu.tmp\", (unsigned long)GetCurrentProcessId());" << endl;
+	strm << "#else" << endl;
+	strm << "\tsnprintf(suffix, sizeof(suffix), \".%lu.tmp\", (unsigned long)getpid());" << endl;
+	strm << "#endif" << endl;
+	strm << "\tstd::string tempname = std::string(filename) + suffix;" << endl;
+	strm << "\tFILE* file = fopen(tempname.c_str(), \"wb\");" << endl;
+	strm << "\tif (!file)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tbool written = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();" << endl;
+	strm << "\twritten = fclose(file) == 0 && written;" << endl;
+	strm << "#if defined(_WIN32)" << endl;
+	strm << "\twritten = written && MoveFileExA(tempname.c_str(), filename, MOVEFILE_REPLACE_EXISTING) != 0;" << endl;
+	strm << "#else" << endl;
+	strm << "\twritten = written && rename(tempname.c_str(), filename) == 0;" << endl;
+	strm << "#endif" << endl;
+	strm << "\tif (!written)" << endl;
+	strm << "\t\tremove(tempname.c_str());" << endl;
+	strm << "\treturn written;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// maps a snapshot written by export_snapshot() with the same layout" << endl;
+	strm << "bool open_snapshot(const char* filename, snapshot_file& file) {" << endl;
+	strm << "\tfile.data = 0;" << endl;
+	strm << "\tfile.size = 0;" << endl;
+	strm << "\tfile.mapping = 0;" << endl;
+	strm << "#if defined(_WIN32)" << endl;
+	strm << "\tHANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);" << endl;
+	strm << "\tif (handle == INVALID_HANDLE_VALUE)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tLARGE_INTEGER size;" << endl;
+	strm << "\tif (GetFileSizeEx(handle, &size) && size.QuadPart > 0)" << endl;
+	strm << "\t\tfile.mapping = CreateFileMappingA(handle, 0, PAGE_READONLY, 0, 0, 0);" << endl;
+	strm << "\tCloseHandle(handle);" << endl;
+	strm << "\tif (!file.mapping)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tfile.data = (const unsigned char*)MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0);" << endl;
+	strm << "\tif (!file.data) {" << endl;
+	strm << "\t\tCloseHandle(file.mapping);" << endl;
+	strm << "\t\tfile.mapping = 0;" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tfile.size = size.QuadPart;" << endl;
+	strm << "#else" << endl;
+	strm << "\tint fd = ::open(filename, O_RDONLY);" << endl;
+	strm << "\tif (fd == -1)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tstruct stat st;" << endl;
+	strm << "\tif (fstat(fd, &st) == 0 && st.st_size > 0) {" << endl;
+	strm << "\t\tvoid* data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);" << endl;
+	strm << "\t\tif (data != MAP_FAILED) {" << endl;
+	strm << "\t\t\tfile.data = (const unsigned char*)data;" << endl;
+	strm << "\t\t\tfile.size = st.st_size;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t}" << endl;
+	strm << "\tclose(fd);" << endl;
+	strm << "#endif" << endl;
+	strm << "\tif (!file.data)" << endl;
+	strm << "\t\treturn false;" << endl << endl;
+
+	strm << "\tconst snapshot_header* header = (const snapshot_header*)file.data;" << endl;
+	strm << "\tconst snapshot_table_entry* entries = (const snapshot_table_entry*)(file.data + sizeof(snapshot_header));" << endl;
+	strm << "\tbool valid = file.size >= sizeof(snapshot_header) + " << tablecount << " * sizeof(snapshot_table_entry) &&" << endl;
+	strm << "\t\tmemcmp(header->magic, \"dbgensnp\", sizeof(header->magic)) == 0 &&" << endl;
+	strm << "\t\theader->version == snapshot_format_version &&" << endl;
+	strm << "\t\theader->table_count == " << tablecount << " &&" << endl;
+	strm << "\t\theader->layout_hash == snapshot_layout_hash;" << endl;
+	strm << "\tfor (int i = 0; valid && i < " << tablecount << "; i++) {" << endl;
+	strm << "\t\tvalid = entries[i].columns_offset <= entries[i].heap_offset && entries[i].heap_offset + entries[i].heap_size <= file.size;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (!valid)" << endl;
+	strm << "\t\tclose_snapshot(file);" << endl;
+	strm << "\treturn valid;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void close_snapshot(snapshot_file& file) {" << endl;
+	strm << "#if defined(_WIN32)" << endl;
+	strm << "\tif (file.data)" << endl;
+	strm << "\t\tUnmapViewOfFile(file.data);" << endl;
+	strm << "\tif (file.mapping)" << endl;
+	strm << "\t\tCloseHandle(file.mapping);" << endl;
+	strm << "#else" << endl;
+	strm << "\tif (file.data)" << endl;
+	strm << "\t\tmunmap((void*)file.data, (size_t)file.size);" << endl;
+	strm << "#endif" << endl;
+	strm << "\tfile.data = 0;" << endl;
+	strm << "\tfile.size = 0;" << endl;
+	strm << "\tfile.mapping = 0;" << endl;
+	strm << "}" << endl << endl;
+}
+
+struct navigationedge {
+	tableinfo* child;
+	fieldinfo* field;
+	tableinfo* parent;
+	string suffix; // distinguishes several keys from one child to one parent
+};
+
+// reads the children of one parent through the foreign key field of child
+string children_query(tableinfo& child, fieldinfo& field) {
+	stringstream columns;
+	for (size_t i = 0; i < child.fields.size(); i++) {
+		if (i > 0) columns << ", ";
+		columns << child.tablename << "." << child.fields[i].fieldname;
+	}
+	return "select " + columns.str() + " from " + child.tablename + " where " + field.fieldname + " = ?1;";
+}
+
+// reads the children of all parents in temp.dbgenpp_navigation_keys. the
+// cross join keeps the keys in the outer loop, so the children are searched
+// through the foreign key index instead of scanned.
+string children_join_query(tableinfo& child, fieldinfo& field) {
+	stringstream columns;
+	for (size_t i = 0; i < child.fields.size(); i++) {
+		if (i > 0) columns << ", ";
+		columns << child.tablename << "." << child.fields[i].fieldname;
+	}
+	return "select " + columns.str() + " from temp.dbgenpp_navigation_keys cross join " + child.tablename + " on " + child.tablename + "." + field.fieldname + " = dbgenpp_navigation_keys.id;";
+}
+
+// reads the parent referenced by the foreign key field of a child
+string parent_query(tableinfo& parent, fieldinfo& field) {
+	stringstream columns;
+	for (size_t i = 0; i < parent.fields.size(); i++) {
+		if (i > 0) columns << ", ";
+		columns << parent.fields[i].fieldname;
+	}
+	return "select " + columns.str() + " from " + parent.tablename + " where " + field.keyname + " = ?1;";
+}
+
+// returns the foreign keys navigated by the helpers. the keys are passed and
+// batched as ints, so keys of other types, or referencing a field of another
+// type, get no helpers.
+std::vector<navigationedge> navigation_edges(std::vector<tableinfo>& tables) {
+	std::vector<navigationedge> result;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			if (finfo.keytable.empty())
+				continue;
+			int samekeys = 0;
+			for (size_t k = 0; k < tabinfo.fields.size(); k++) {
+				if (tabinfo.fields[k].keytable == finfo.keytable) samekeys++;
+			}
+			for (size_t k = 0; k < tables.size(); k++) {
+				if (tables[k].tablename != finfo.keytable || finfo.type != dbgen_integer)
+					continue;
+				bool integerkey = false;
+				for (size_t l = 0; l < tables[k].fields.size(); l++) {
+					if (tables[k].fields[l].fieldname == finfo.keyname)
+						integerkey = tables[k].fields[l].type == dbgen_integer;
+				}
+				if (!integerkey)
+					continue;
+				navigationedge edge;
+				edge.child = &tabinfo;
+				edge.field = &finfo;
+				edge.parent = &tables[k];
+				edge.suffix = samekeys > 1 ? "_by_" + finfo.fieldname : "";
+				result.push_back(edge);
+			}
+		}
+	}
+	return result;
+}
+
+void documentgen::generate_navigation_header(std::ostream& strm) {
+	std::vector<navigationedge> edges = navigation_edges(tables);
+	strm << "struct sqlite3;" << endl << endl;
+
+	strm << "// navigation statements of one connection, prepared on first use and" << endl;
+	strm << "// finalized by the destructor" << endl;
+	strm << "struct navigation_statements {" << endl;
+	strm << "\texplicit navigation_statements(sqlite3* db);" << endl;
+	strm << "\t~navigation_statements();" << endl;
+	strm << "\tsqlite3* db;" << endl;
+	strm << "\tsqlite3_stmt* statements[" << (2 + 3 * edges.size()) << "];" << endl;
+	strm << "private:" << endl;
+	strm << "\tnavigation_statements(const navigation_statements&);" << endl;
+	strm << "\tnavigation_statements& operator=(const navigation_statements&);" << endl;
+	strm << "};" << endl << endl;
+
+	for (size_t i = 0; i < edges.size(); i++) {
+		navigationedge& edge = edges[i];
+		std::string childdata = edge.child->tablename + "data";
+		std::string name = "children_" + edge.child->tablename + "_of_" + edge.parent->tablename + edge.suffix;
+		strm << "bool " << name << "(navigation_statements& nav, int parent, std::vector<" << childdata << ">& result);" << endl;
+		strm << "bool " << name << "(navigation_statements& nav, const std::vector<int>& parents, std::vector<std::vector<" << childdata << "> >& result);" << endl;
+		strm << "bool parent" << edge.suffix << "_of(navigation_statements& nav, const " << childdata << "& child, " << edge.parent->tablename << "data& result);" << endl;
+	}
+	strm << endl;
+}
+
+// children are read with one query per parent, or with one join against
+// the temp table dbgenpp_navigation_keys for a batch of parents. the
+// statements live in navigation_statements: the two key table statements
+// first, then the single, batched and parent statements of each edge.
+void documentgen::generate_navigation_implementation(std::ostream& strm) {
+	std::vector<navigationedge> edges = navigation_edges(tables);
+	strm << "const char navigation_keys_script[] = \"create temp table if not exists dbgenpp_navigation_keys (id integer primary key);\";" << endl << endl;
+
+	strm << "// the texts of navigation_statements::statements" << endl;
+	strm << "const char* const navigation_queries[] = {" << endl;
+	strm << "\t\"insert or ignore into temp.dbgenpp_navigation_keys values (?1);\"," << endl;
+	strm << "\t\"delete from temp.dbgenpp_navigation_keys;\"";
+	for (size_t i = 0; i < edges.size(); i++) {
+		strm << "," << endl << "\t\"" << children_query(*edges[i].child, *edges[i].field) << "\"," << endl;
+		strm << "\t\"" << children_join_query(*edges[i].child, *edges[i].field) << "\"," << endl;
+		strm << "\t\"" << parent_query(*edges[i].parent, *edges[i].field) << "\"";
+	}
+	strm << endl << "};" << endl << endl;
+	for (size_t i = 0; i < 2 + 3 * edges.size(); i++) {
+		stringstream query;
+		query << "navigation_queries[" << i << "]";
+		add_query_plan(query.str(), i >= 2 && (i - 2) % 3 == 1 ? "\"temp.dbgenpp_navigation_keys\"" : "0");
+	}
+
+	strm << "navigation_statements::navigation_statements(sqlite3* db) : db(db) {" << endl;
+	strm << "\tfor (size_t i = 0; i < sizeof(statements) / sizeof(statements[0]); i++) {" << endl;
+	strm << "\t\tstatements[i] = 0;" << endl;
+	strm << "\t}" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "navigation_statements::~navigation_statements() {" << endl;
+	strm << "\tfor (size_t i = 0; i < sizeof(statements) / sizeof(statements[0]); i++) {" << endl;
+	strm << "\t\tsqlite3_finalize(statements[i]);" << endl;
+	strm << "\t}" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "sqlite3_stmt* navigation_statement(navigation_statements& nav, int index) {" << endl;
+	strm << "\tsqlite3_stmt*& stmt = nav.statements[index];" << endl;
+	strm << "\tif (stmt == 0 && sqlite3_prepare_v2(nav.db, navigation_queries[index], -1, &stmt, 0) != SQLITE_OK) {" << endl;
+	strm << "\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t\tstmt = 0;" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn stmt;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool fill_navigation_keys(navigation_statements& nav, const std::vector<int>& keys) {" << endl;
+	strm << "\tif (nav.statements[0] == 0 &&" << endl;
+	strm << "\t\tsqlite3_exec(nav.db, navigation_keys_script, 0, 0, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_stmt* insert = navigation_statement(nav, 0);" << endl;
+	strm << "\tsqlite3_stmt* clear = navigation_statement(nav, 1);" << endl;
+	strm << "\tif (!insert || !clear)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tbool result = sqlite3_step(clear) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_reset(clear);" << endl;
+	strm << "\tfor (size_t i = 0; i < keys.size() && result; i++) {" << endl;
+	strm << "\t\tsqlite3_bind_int(insert, 1, keys[i]);" << endl;
+	strm << "\t\tresult = sqlite3_step(insert) == SQLITE_DONE;" << endl;
+	strm << "\t\tsqlite3_reset(insert);" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	for (size_t i = 0; i < edges.size(); i++) {
+		navigationedge& edge = edges[i];
+		tableinfo& child = *edge.child;
+		tableinfo& parent = *edge.parent;
+		std::string childdata = child.tablename + "data";
+		std::string name = "children_" + child.tablename + "_of_" + parent.tablename + edge.suffix;
+		size_t slot = 2 + 3 * i;
+
+		strm << "bool " << name << "(navigation_statements& nav, int parent, std::vector<" << childdata << ">& result) {" << endl;
+		strm << "\tresult.clear();" << endl;
+		strm << "\tsqlite3_stmt* stmt = navigation_statement(nav, " << slot << ");" << endl;
+		strm << "\tif (!stmt)" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tsqlite3_bind_int(stmt, 1, parent);" << endl;
+		strm << "\tint step;" << endl;
+		strm << "\twhile ((step = sqlite3_step(stmt)) == SQLITE_ROW) {" << endl;
+		strm << "\t\tresult.push_back(" << childdata << "());" << endl;
+		strm << "\t\tread_" << child.tablename << "(stmt, result.back());" << endl;
+		strm << "\t}" << endl;
+		strm << "\tsqlite3_reset(stmt);" << endl;
+		strm << "\treturn step == SQLITE_DONE;" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "// result[i] receives the children of parents[i]" << endl;
+		strm << "bool " << name << "(navigation_statements& nav, const std::vector<int>& parents, std::vector<std::vector<" << childdata << "> >& result) {" << endl;
+		strm << "\tresult.assign(parents.size(), std::vector<" << childdata << ">());" << endl;
+		strm << "\tstd::map<int, size_t> index;" << endl;
+		strm << "\tfor (size_t i = 0; i < parents.size(); i++) {" << endl;
+		strm << "\t\tindex.insert(std::make_pair(parents[i], i));" << endl;
+		strm << "\t}" << endl;
+		strm << "\tif (!fill_navigation_keys(nav, parents))" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tsqlite3_stmt* stmt = navigation_statement(nav, " << (slot + 1) << ");" << endl;
+		strm << "\tif (!stmt)" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tint step;" << endl;
+		strm << "\twhile ((step = sqlite3_step(stmt)) == SQLITE_ROW) {" << endl;
+		strm << "\t\t" << childdata << " data;" << endl;
+		strm << "\t\tread_" << child.tablename << "(stmt, data);" << endl;
+		strm << "\t\tresult[index[data." << edge.field->fieldname << "]].push_back(data);" << endl;
+		strm << "\t}" << endl;
+		strm << "\tsqlite3_reset(stmt);" << endl;
+		strm << "\tfor (size_t i = 0; i < parents.size(); i++) {" << endl;
+		strm << "\t\tif (index[parents[i]] != i)" << endl;
+		strm << "\t\t\tresult[i] = result[index[parents[i]]];" << endl;
+		strm << "\t}" << endl;
+		strm << "\treturn step == SQLITE_DONE;" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "bool parent" << edge.suffix << "_of(navigation_statements& nav, const " << childdata << "& child, " << parent.tablename << "data& result) {" << endl;
+		strm << "\tsqlite3_stmt* stmt = navigation_statement(nav, " << (slot + 2) << ");" << endl;
+		strm << "\tif (!stmt)" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tsqlite3_bind_int(stmt, 1, child." << edge.field->fieldname << ");" << endl;
+		strm << "\tbool found = sqlite3_step(stmt) == SQLITE_ROW;" << endl;
+		strm << "\tif (found)" << endl;
+		strm << "\t\tread_" << parent.tablename << "(stmt, result);" << endl;
+		strm << "\tsqlite3_reset(stmt);" << endl;
+		strm << "\treturn found;" << endl;
+		strm << "}" << endl << endl;
+	}
+}
+
+void documentgen::generate_upsert_header(std::ostream& strm) {
+	strm << "struct sqlite3;" << endl << endl;
+
+	strm << "// statements of one connection, prepared on first use and reused until" << endl;
+	strm << "// the struct is destroyed" << endl;
+	strm << "struct write_statements {" << endl;
+	strm << "\tsqlite3* db;" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!upsert_table(tabinfo)) continue;
+		strm << "\tsqlite3_stmt* upsert_" << tabinfo.tablename << ";" << endl;
+		strm << "\tstd::map<unsigned long long, sqlite3_stmt*> update_" << tabinfo.tablename << "_columns;" << endl;
+	}
+	strm << endl;
+	strm << "\texplicit write_statements(sqlite3* db);" << endl;
+	strm << "\t~write_statements();" << endl << endl;
+	strm << "private:" << endl;
+	strm << "\twrite_statements(const write_statements&);" << endl;
+	strm << "\twrite_statements& operator=(const write_statements&);" << endl;
+	strm << "};" << endl << endl;
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!upsert_table(tabinfo)) continue;
+		std::string datatype = tabinfo.tablename + "data";
+		strm << "bool upsert_" << tabinfo.tablename << "(write_statements& statements, const " << datatype << "& data);" << endl;
+		strm << "bool upsert_" << tabinfo.tablename << "_batch(write_statements& statements, const std::vector<" << datatype << ">& rows);" << endl;
+		strm << "bool update_" << tabinfo.tablename << "_columns(write_statements& statements, const " << datatype << "& data, unsigned long long columns);" << endl;
+		strm << "bool update_" << tabinfo.tablename << "_columns_batch(write_statements& statements, const std::vector<" << datatype << ">& rows, unsigned long long columns);" << endl;
+	}
+	strm << endl;
+}
+
+// upserts insert a row or update all columns of the row with the same key.
+// the column updates write the columns whose changed_bit() is set in
+// columns, with one statement prepared per set of columns. batches run in
+// a savepoint, so they are applied completely or not at all. an upsert is
+// an insert statement, so before insert triggers also fire for rows which
+// it updates, followed by the update triggers.
+void documentgen::generate_upsert_implementation(std::ostream& strm) {
+	strm << "bool step_write_statement(sqlite3_stmt* stmt) {" << endl;
+	strm << "\tbool result = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_reset(stmt);" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "bool write_batch(sqlite3* db, sqlite3_stmt* stmt, const std::vector<T>& rows, unsigned long long columns, void (*bind)(sqlite3_stmt*, const T&, unsigned long long)) {" << endl;
+	strm << "\tif (sqlite3_exec(db, \"savepoint dbgenpp_write_batch;\", 0, 0, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tbool result = true;" << endl;
+	strm << "\tfor (size_t i = 0; i < rows.size() && result; i++) {" << endl;
+	strm << "\t\tbind(stmt, rows[i], columns);" << endl;
+	strm << "\t\tresult = step_write_statement(stmt);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (!result)" << endl;
+	strm << "\t\tsqlite3_exec(db, \"rollback to dbgenpp_write_batch;\", 0, 0, 0);" << endl;
+	strm << "\treturn sqlite3_exec(db, \"release dbgenpp_write_batch;\", 0, 0, 0) == SQLITE_OK && result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool prepare_write_statement(sqlite3* db, const char* query, sqlite3_stmt** stmt) {" << endl;
+	strm << "\treturn *stmt != 0 || sqlite3_prepare_v2(db, query, -1, stmt, 0) == SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// the update of the selected columns by key, or an empty string when no" << endl;
+	strm << "// column besides the key is selected" << endl;
+	strm << "std::string update_columns_query(const char* table, const char* const* names, int count, int key, unsigned long long columns) {" << endl;
+	strm << "\tstd::string assignments;" << endl;
+	strm << "\tfor (int j = 0; j < count; j++) {" << endl;
+	strm << "\t\tif (j == key || (columns & (1ULL << (j < 63 ? j : 63))) == 0)" << endl;
+	strm << "\t\t\tcontinue;" << endl;
+	strm << "\t\tif (!assignments.empty()) assignments += \", \";" << endl;
+	strm << "\t\tassignments += std::string(names[j]) + \" = ?\" + std::to_string(j + 1);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (assignments.empty())" << endl;
+	strm << "\t\treturn assignments;" << endl;
+	strm << "\treturn std::string(\"update \") + table + \" set \" + assignments + \" where \" + names[key] + \" = ?\" + std::to_string(key + 1) + \";\";" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// prepares the update of the selected columns by key, or sets stmt to 0" << endl;
+	strm << "// when no column besides the key is selected" << endl;
+	strm << "bool prepare_update_columns(sqlite3* db, std::map<unsigned long long, sqlite3_stmt*>& cache, const char* table, const char* const* names, int count, int key, unsigned long long columns, sqlite3_stmt** stmt) {" << endl;
+	strm << "\tstd::map<unsigned long long, sqlite3_stmt*>::iterator i = cache.find(columns);" << endl;
+	strm << "\tif (i != cache.end()) {" << endl;
+	strm << "\t\t*stmt = i->second;" << endl;
+	strm << "\t\treturn true;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tstd::string query = update_columns_query(table, names, count, key, columns);" << endl;
+	strm << "\t*stmt = 0;" << endl;
+	strm << "\tif (!query.empty()) {" << endl;
+	strm << "\t\tif (sqlite3_prepare_v2(db, query.c_str(), -1, stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tcache[columns] = *stmt;" << endl;
+	strm << "\treturn true;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "write_statements::write_statements(sqlite3* db)" << endl;
+	strm << "\t: db(db)" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (upsert_table(tables[i]))
+			strm << "\t, upsert_" << tables[i].tablename << "(0)" << endl;
+	}
+	strm << "{" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "write_statements::~write_statements() {" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!upsert_table(tabinfo)) continue;
+		strm << "\tsqlite3_finalize(upsert_" << tabinfo.tablename << ");" << endl;
+		std::string cache = "update_" + tabinfo.tablename + "_columns";
+		strm << "\tfor (std::map<unsigned long long, sqlite3_stmt*>::iterator i = " << cache << ".begin(); i != " << cache << ".end(); ++i) {" << endl;
+		strm << "\t\tsqlite3_finalize(i->second);" << endl;
+		strm << "\t}" << endl;
+	}
+	strm << "}" << endl << endl;
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!upsert_table(tabinfo)) continue;
+		std::string datatype = tabinfo.tablename + "data";
+		std::string traits = datatype + "::table_traits::";
+		size_t key = primary_key_index(tabinfo);
+
+		// the column updates leave the parameters of unselected columns out
+		// of their statements, so only the key and the selected columns are
+		// bound. the statements are stepped right after binding.
+		strm << "void bind_" << tabinfo.tablename << "_columns(sqlite3_stmt* stmt, const " << datatype << "& data, unsigned long long columns) {" << endl;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			if (j == key) {
+				generate_bind_value(finfo, j + 1, "data." + finfo.fieldname, "SQLITE_STATIC", "\t", strm);
+				continue;
+			}
+			strm << "\tif ((columns & (1ULL << " << changed_bit(j) << ")) != 0) {" << endl;
+			generate_bind_value(finfo, j + 1, "data." + finfo.fieldname, "SQLITE_STATIC", "\t\t", strm);
+			strm << "\t}" << endl;
+		}
+		strm << "}" << endl << endl;
+
+		std::string stmt = "statements.upsert_" + tabinfo.tablename;
+		strm << "bool upsert_" << tabinfo.tablename << "(write_statements& statements, const " << datatype << "& data) {" << endl;
+		strm << "\tif (!prepare_write_statement(statements.db, " << traits << "upsert_query(), &" << stmt << "))" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tbind_" << tabinfo.tablename << "_columns(" << stmt << ", data, ~0ULL);" << endl;
+		strm << "\treturn step_write_statement(" << stmt << ");" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "bool upsert_" << tabinfo.tablename << "_batch(write_statements& statements, const std::vector<" << datatype << ">& rows) {" << endl;
+		strm << "\tif (!prepare_write_statement(statements.db, " << traits << "upsert_query(), &" << stmt << "))" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\treturn write_batch(statements.db, " << stmt << ", rows, ~0ULL, bind_" << tabinfo.tablename << "_columns);" << endl;
+		strm << "}" << endl << endl;
+
+		stringstream prepare;
+		prepare << "prepare_update_columns(statements.db, statements.update_" << tabinfo.tablename << "_columns, " << traits << "name(), ";
+		prepare << tabinfo.tablename << "_column_names, " << traits << "column_count, " << traits << "key_parameter - 1, columns, &stmt)";
+
+		strm << "bool update_" << tabinfo.tablename << "_columns(write_statements& statements, const " << datatype << "& data, unsigned long long columns) {" << endl;
+		strm << "\tsqlite3_stmt* stmt;" << endl;
+		strm << "\tif (!" << prepare.str() << ")" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tif (stmt == 0)" << endl;
+		strm << "\t\treturn true;" << endl;
+		strm << "\tbind_" << tabinfo.tablename << "_columns(stmt, data, columns);" << endl;
+		strm << "\treturn step_write_statement(stmt);" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "bool update_" << tabinfo.tablename << "_columns_batch(write_statements& statements, const std::vector<" << datatype << ">& rows, unsigned long long columns) {" << endl;
+		strm << "\tsqlite3_stmt* stmt;" << endl;
+		strm << "\tif (!" << prepare.str() << ")" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tif (stmt == 0)" << endl;
+		strm << "\t\treturn true;" << endl;
+		strm << "\treturn write_batch(statements.db, stmt, rows, columns, bind_" << tabinfo.tablename << "_columns);" << endl;
+		strm << "}" << endl << endl;
+	}
+}
+
+// cursors page through tables by a field marked primary of type int, which
+// is unique and indexed as the rowid. the fallback of primary_key_index() to
+// "id" or the first field may be neither, so other tables get no cursor.
+bool cursor_table(tableinfo& tabinfo) {
+	return tabinfo.shardkey.empty() && has_primary_key(tabinfo) && tabinfo.fields[primary_key_index(tabinfo)].type == dbgen_integer;
+}
+
+void documentgen::generate_cursors_header(std::ostream& strm) {
+	strm << "struct sqlite3;" << endl << endl;
+
+	strm << "// the paging shared by the table cursors" << endl;
+	strm << "struct table_cursor {" << endl;
+	strm << "\tsqlite3* db;" << endl;
+	strm << "\tsqlite3_stmt* stmt;" << endl;
+	strm << "\tint pagesize;" << endl;
+	strm << "\tint pagerows; // rows read from the current page, -1 before a page" << endl;
+	strm << "\tlong long last; // key of the last row read" << endl;
+	strm << "\tbool finished;" << endl;
+	strm << "\tbool failed; // a statement failed, the rows read so far are valid" << endl << endl;
+	strm << "\ttable_cursor(sqlite3* db, int pagesize);" << endl;
+	strm << "\t~table_cursor();" << endl;
+	strm << "\tbool prepare(const char* table, const char* const* names, int count, int key, unsigned long long columns, const char* condition);" << endl;
+	strm << "\tbool step();" << endl << endl;
+	strm << "private:" << endl;
+	strm << "\ttable_cursor(const table_cursor&);" << endl;
+	strm << "\ttable_cursor& operator=(const table_cursor&);" << endl;
+	strm << "};" << endl << endl;
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!cursor_table(tabinfo)) continue;
+		std::string cursor = tabinfo.tablename + "_cursor";
+		std::string datatype = tabinfo.tablename + "data";
+
+		strm << "struct " << cursor << " : table_cursor {" << endl;
+		strm << "\t" << datatype << " row; // the current row, reused for every row" << endl << endl;
+		strm << "\tstruct iterator {" << endl;
+		strm << "\t\t" << cursor << "* cursor;" << endl << endl;
+		strm << "\t\tconst " << datatype << "& operator*() const { return cursor->row; }" << endl;
+		strm << "\t\tconst " << datatype << "* operator->() const { return &cursor->row; }" << endl;
+		strm << "\t\titerator& operator++() { if (!cursor->next()) cursor = 0; return *this; }" << endl;
+		strm << "\t\tbool operator==(const iterator& other) const { return cursor == other.cursor; }" << endl;
+		strm << "\t\tbool operator!=(const iterator& other) const { return cursor != other.cursor; }" << endl;
+		strm << "\t};" << endl << endl;
+		strm << "\t" << cursor << "(sqlite3* db, int pagesize = 1000, unsigned long long columns = ~0ULL, const char* condition = 0);" << endl;
+		strm << "\tbool next();" << endl;
+		strm << "\titerator begin();" << endl;
+		strm << "\titerator end();" << endl;
+		strm << "};" << endl << endl;
+	}
+}
+
+// a cursor reads pagesize rows per statement execution, continuing after
+// the key of the last row read, so the statement is reset and its read
+// transaction ends between pages. the statement is prepared once, and each
+// row is read into the same row struct.
+void documentgen::generate_cursors_implementation(std::ostream& strm) {
+	strm << "table_cursor::table_cursor(sqlite3* db, int pagesize)" << endl;
+	strm << "\t: db(db), stmt(0), pagesize(pagesize > 0 ? pagesize : 1), pagerows(-1), last(LLONG_MIN), finished(false), failed(false)" << endl;
+	strm << "{" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "table_cursor::~table_cursor() {" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// columns not selected in columns are read as null. condition is an" << endl;
+	strm << "// optional sql expression rows must satisfy." << endl;
+	strm << "std::string table_cursor_query(const char* table, const char* const* names, int count, int key, unsigned long long columns, const char* condition) {" << endl;
+	strm << "\tstd::string query = \"select \";" << endl;
+	strm << "\tfor (int i = 0; i < count; i++) {" << endl;
+	strm << "\t\tif (i > 0) query += \", \";" << endl;
+	strm << "\t\tquery += (i == key || (columns & (1ULL << (i < 63 ? i : 63))) != 0) ? names[i] : \"null\";" << endl;
+	strm << "\t}" << endl;
+	strm << "\tquery += std::string(\" from \") + table + \" where \" + names[key] + \" > ?1\";" << endl;
+	strm << "\tif (condition != 0 && *condition != 0)" << endl;
+	strm << "\t\tquery += std::string(\" and (\") + condition + \")\";" << endl;
+	strm << "\tquery += std::string(\" order by \") + names[key] + \" limit ?2;\";" << endl;
+	strm << "\treturn query;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool table_cursor::prepare(const char* table, const char* const* names, int count, int key, unsigned long long columns, const char* condition) {" << endl;
+	strm << "\tstd::string query = table_cursor_query(table, names, count, key, columns, condition);" << endl;
+	strm << "\tfailed = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, 0) != SQLITE_OK;" << endl;
+	strm << "\treturn !failed;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// returns true with the statement on the next row" << endl;
+	strm << "bool table_cursor::step() {" << endl;
+	strm << "\twhile (!finished && !failed) {" << endl;
+	strm << "\t\tif (pagerows == -1) {" << endl;
+	strm << "\t\t\tsqlite3_bind_int64(stmt, 1, last);" << endl;
+	strm << "\t\t\tsqlite3_bind_int(stmt, 2, pagesize);" << endl;
+	strm << "\t\t\tpagerows = 0;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t\tint result = sqlite3_step(stmt);" << endl;
+	strm << "\t\tif (result == SQLITE_ROW) {" << endl;
+	strm << "\t\t\tpagerows++;" << endl;
+	strm << "\t\t\treturn true;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t\tsqlite3_reset(stmt);" << endl;
+	strm << "\t\tif (result != SQLITE_DONE)" << endl;
+	strm << "\t\t\tfailed = true;" << endl;
+	strm << "\t\telse if (pagerows < pagesize)" << endl;
+	strm << "\t\t\tfinished = true;" << endl;
+	strm << "\t\tpagerows = -1;" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn false;" << endl;
+	strm << "}" << endl << endl;
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!cursor_table(tabinfo)) continue;
+		std::string cursor = tabinfo.tablename + "_cursor";
+		std::string traits = tabinfo.tablename + "data::table_traits::";
+		std::string key = tabinfo.fields[primary_key_index(tabinfo)].fieldname;
+
+		strm << cursor << "::" << cursor << "(sqlite3* db, int pagesize, unsigned long long columns, const char* condition)" << endl;
+		strm << "\t: table_cursor(db, pagesize)" << endl;
+		strm << "{" << endl;
+		strm << "\tprepare(" << traits << "name(), " << tabinfo.tablename << "_column_names, " << traits << "column_count, " << traits << "key_parameter - 1, columns, condition);" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "bool " << cursor << "::next() {" << endl;
+		strm << "\tif (!step())" << endl;
+		strm << "\t\treturn false;" << endl;
+		strm << "\tread_" << tabinfo.tablename << "(stmt, row);" << endl;
+		strm << "\tlast = row." << key << ";" << endl;
+		strm << "\treturn true;" << endl;
+		strm << "}" << endl << endl;
+
+		strm << cursor << "::iterator " << cursor << "::begin() {" << endl;
+		strm << "\titerator result = { next() ? this : 0 };" << endl;
+		strm << "\treturn result;" << endl;
+		strm << "}" << endl << endl;
+
+		strm << cursor << "::iterator " << cursor << "::end() {" << endl;
+		strm << "\titerator result = { 0 };" << endl;
+		strm << "\treturn result;" << endl;
+		strm << "}" << endl << endl;
+	}
+}
+
+bool documentgen::has_fulltext_tables() {
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (has_fulltext(tables[i])) return true;
+	}
+	return false;
+}
+
+void documentgen::generate_fulltext_header(std::ostream& strm) {
+	strm << "struct sqlite3;" << endl << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!has_fulltext(tabinfo)) continue;
+		strm << "bool search_" << tabinfo.tablename << "(sqlite3* db, const std::string& query, int limit, std::vector<int>& result);" << endl;
+		strm << "bool search_" << tabinfo.tablename << "(sqlite3* db, const std::string& query, int limit, std::vector<" << tabinfo.tablename << "data>& result);" << endl;
+	}
+	strm << endl;
+}
+
+// search_<table> runs an fts5 match query against <table>_fts and returns the
+// ids or rows of at most limit matches, best bm25 rank first. a negative
+// limit returns all matches.
+void documentgen::generate_fulltext_implementation(std::ostream& strm) {
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!has_fulltext(tabinfo)) continue;
+		std::string fts = tabinfo.tablename + "_fts";
+		std::string datatype = tabinfo.tablename + "data";
+
+		stringstream columns;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			if (j > 0) columns << ", ";
+			columns << tabinfo.tablename << "." << tabinfo.fields[j].fieldname;
+		}
+
+		strm << "const char search_" << tabinfo.tablename << "_ids_query[] = \"select rowid from " << fts << " where " << fts << " match ?1 order by bm25(" << fts << ") limit ?2;\";" << endl;
+		strm << "const char search_" << tabinfo.tablename << "_rows_query[] = \"select " << columns.str() << " from " << fts << " join " << tabinfo.tablename << " on " << tabinfo.tablename << ".id = " << fts << ".rowid where " << fts << " match ?1 order by bm25(" << fts << ") limit ?2;\";" << endl << endl;
+		add_query_plan("search_" + tabinfo.tablename + "_ids_query");
+		add_query_plan("search_" + tabinfo.tablename + "_rows_query");
+
+		strm << "bool search_" << tabinfo.tablename << "(sqlite3* db, const std::string& query, int limit, std::vector<int>& result) {" << endl;
+		strm << "	result.clear();" << endl;
+		strm << "	sqlite3_stmt* stmt = 0;" << endl;
+		strm << "	if (sqlite3_prepare_v2(db, search_" << tabinfo.tablename << "_ids_query, -1, &stmt, 0) != SQLITE_OK)" << endl;
+		strm << "		return false;" << endl;
+		strm << "	sqlite3_bind_text(stmt, 1, query.c_str(), (int)query.size(), SQLITE_STATIC);" << endl;
+		strm << "	sqlite3_bind_int(stmt, 2, limit);" << endl;
+		strm << "	int step;" << endl;
+		strm << "	while ((step = sqlite3_step(stmt)) == SQLITE_ROW) {" << endl;
+		strm << "		result.push_back(sqlite3_column_int(stmt, 0));" << endl;
+		strm << "	}" << endl;
+		strm << "	sqlite3_finalize(stmt);" << endl;
+		strm << "	return step == SQLITE_DONE;" << endl;
+		strm << "}" << endl << endl;
+
+		strm << "bool search_" << tabinfo.tablename << "(sqlite3* db, const std::string& query, int limit, std::vector<" << datatype << ">& result) {" << endl;
+		strm << "	result.clear();" << endl;
+		strm << "	sqlite3_stmt* stmt = 0;" << endl;
+		strm << "	if (sqlite3_prepare_v2(db, search_" << tabinfo.tablename << "_rows_query, -1, &stmt, 0) != SQLITE_OK)" << endl;
+		strm << "		return false;" << endl;
+		strm << "	sqlite3_bind_text(stmt, 1, query.c_str(), (int)query.size(), SQLITE_STATIC);" << endl;
+		strm << "	sqlite3_bind_int(stmt, 2, limit);" << endl;
+		strm << "	int step;" << endl;
+		strm << "	while ((step = sqlite3_step(stmt)) == SQLITE_ROW) {" << endl;
+		strm << "		result.push_back(" << datatype << "());" << endl;
+		strm << "		read_" << tabinfo.tablename << "(stmt, result.back());" << endl;
+		strm << "	}" << endl;
+		strm << "	sqlite3_finalize(stmt);" << endl;
+		strm << "	return step == SQLITE_DONE;" << endl;
+		strm << "}" << endl << endl;
+	}
+}
+
+void documentgen::generate_virtual_tables_header(std::ostream& strm) {
+	strm << "struct sqlite3;" << endl << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		strm << "bool register_" << tabinfo.tablename << "_vector(sqlite3* db, const char* name, const std::vector<" << tabinfo.tablename << "data>& rows);" << endl;
+	}
+	strm << endl;
+}
+
+// equality constraints use an index on the integer key and foreign key
+// columns. the index holds int values, so other columns are scanned.
+bool vector_indexed(tableinfo& tabinfo, size_t column) {
+	fieldinfo& finfo = tabinfo.fields[column];
+	return finfo.type == dbgen_integer && (column == primary_key_index(tabinfo) || !finfo.keytable.empty());
+}
+
+// the virtual tables are eponymous and read-only. the module functions are
+// shared templates over a generated <table>_vector_traits, which knows the
+// declared schema, which columns have an equality index, and how to return
+// a column of a row without copying.
+void documentgen::generate_virtual_tables_implementation(std::ostream& strm) {
+	strm << "// equality lookups on the key and foreign key columns use an index of" << endl;
+	strm << "// (value, row) pairs per column. it belongs to the registered vector, so it" << endl;
+	strm << "// is sorted once and shared by all cursors and statements, and it is rebuilt" << endl;
+	strm << "// when the vector's size or storage has changed since it was sorted." << endl;
+	strm << "template <typename T>" << endl;
+	strm << "struct vector_source {" << endl;
+	strm << "\tconst std::vector<typename T::data>* rows;" << endl;
+	strm << "\tstd::vector<std::pair<int, size_t> > index[T::column_count];" << endl;
+	strm << "\tbool sorted[T::column_count];" << endl;
+	strm << "\tconst void* sorteddata;" << endl;
+	strm << "\tsize_t sortedsize;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "void vector_source_destroy(void* source) {" << endl;
+	strm << "\tdelete (vector_source<T>*)source;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "const std::vector<std::pair<int, size_t> >& vector_index(vector_source<T>& source, int column) {" << endl;
+	strm << "\tconst std::vector<typename T::data>& rows = *source.rows;" << endl;
+	strm << "\tconst void* data = rows.empty() ? 0 : &rows.front();" << endl;
+	strm << "\tif (source.sorteddata != data || source.sortedsize != rows.size()) {" << endl;
+	strm << "\t\tfor (int i = 0; i < T::column_count; i++) {" << endl;
+	strm << "\t\t\tsource.sorted[i] = false;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t\tsource.sorteddata = data;" << endl;
+	strm << "\t\tsource.sortedsize = rows.size();" << endl;
+	strm << "\t}" << endl;
+	strm << "\tstd::vector<std::pair<int, size_t> >& index = source.index[column];" << endl;
+	strm << "\tif (!source.sorted[column]) {" << endl;
+	strm << "\t\tindex.resize(rows.size());" << endl;
+	strm << "\t\tfor (size_t i = 0; i < rows.size(); i++) {" << endl;
+	strm << "\t\t\tindex[i] = std::make_pair(T::key(rows[i], column), i);" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t\tstd::sort(index.begin(), index.end());" << endl;
+	strm << "\t\tsource.sorted[column] = true;" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn index;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "struct vector_vtab {" << endl;
+	strm << "\tsqlite3_vtab base;" << endl;
+	strm << "\tvector_source<T>* source;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "struct vector_cursor {" << endl;
+	strm << "\tsqlite3_vtab_cursor base;" << endl;
+	strm << "\tvector_source<T>* source;" << endl;
+	strm << "\tconst std::vector<std::pair<int, size_t> >* index;" << endl;
+	strm << "\tsize_t position;" << endl;
+	strm << "\tsize_t end;" << endl << endl;
+	strm << "\tsize_t row() const { return index ? (*index)[position].second : position; }" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_connect(sqlite3* db, void* aux, int, const char* const*, sqlite3_vtab** result, char**) {" << endl;
+	strm << "\tint rc = sqlite3_declare_vtab(db, T::schema());" << endl;
+	strm << "\tif (rc != SQLITE_OK)" << endl;
+	strm << "\t\treturn rc;" << endl;
+	strm << "\tvector_vtab<T>* vtab = new vector_vtab<T>();" << endl;
+	strm << "\tvtab->source = (vector_source<T>*)aux;" << endl;
+	strm << "\t*result = &vtab->base;" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_disconnect(sqlite3_vtab* vtab) {" << endl;
+	strm << "\tdelete (vector_vtab<T>*)vtab;" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// idxNum is the indexed column + 1, or 0 for a full scan. the constraint" << endl;
+	strm << "// is not omitted, so sqlite still checks values which are not integers." << endl;
+	strm << "template <typename T>" << endl;
+	strm << "int vector_best_index(sqlite3_vtab* vtab, sqlite3_index_info* info) {" << endl;
+	strm << "\tsize_t rows = ((vector_vtab<T>*)vtab)->source->rows->size();" << endl;
+	strm << "\tint best = -1;" << endl;
+	strm << "\tfor (int i = 0; i < info->nConstraint; i++) {" << endl;
+	strm << "\t\tconst sqlite3_index_info::sqlite3_index_constraint& constraint = info->aConstraint[i];" << endl;
+	strm << "\t\tif (!constraint.usable || constraint.op != SQLITE_INDEX_CONSTRAINT_EQ || !T::indexed(constraint.iColumn))" << endl;
+	strm << "\t\t\tcontinue;" << endl;
+	strm << "\t\tif (best == -1 || constraint.iColumn == T::key_column)" << endl;
+	strm << "\t\t\tbest = i;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (best == -1) {" << endl;
+	strm << "\t\tinfo->idxNum = 0;" << endl;
+	strm << "\t\tinfo->estimatedCost = (double)rows + 1;" << endl;
+	strm << "\t\tinfo->estimatedRows = rows;" << endl;
+	strm << "\t\treturn SQLITE_OK;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tint column = info->aConstraint[best].iColumn;" << endl;
+	strm << "\tinfo->idxNum = column + 1;" << endl;
+	strm << "\tinfo->aConstraintUsage[best].argvIndex = 1;" << endl;
+	strm << "\tinfo->estimatedCost = column == T::key_column ? 1 : 10;" << endl;
+	strm << "\tinfo->estimatedRows = column == T::key_column ? 1 : 10;" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_open(sqlite3_vtab* vtab, sqlite3_vtab_cursor** result) {" << endl;
+	strm << "\tvector_cursor<T>* cursor = new vector_cursor<T>();" << endl;
+	strm << "\tcursor->source = ((vector_vtab<T>*)vtab)->source;" << endl;
+	strm << "\tcursor->index = 0;" << endl;
+	strm << "\tcursor->position = cursor->end = 0;" << endl;
+	strm << "\t*result = &cursor->base;" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_close(sqlite3_vtab_cursor* cursor) {" << endl;
+	strm << "\tdelete (vector_cursor<T>*)cursor;" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_filter(sqlite3_vtab_cursor* base, int idxnum, const char*, int argc, sqlite3_value** argv) {" << endl;
+	strm << "\tvector_cursor<T>* cursor = (vector_cursor<T>*)base;" << endl;
+	strm << "\tif (idxnum == 0) {" << endl;
+	strm << "\t\tcursor->index = 0;" << endl;
+	strm << "\t\tcursor->position = 0;" << endl;
+	strm << "\t\tcursor->end = cursor->source->rows->size();" << endl;
+	strm << "\t\treturn SQLITE_OK;" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\tconst std::vector<std::pair<int, size_t> >& index = vector_index(*cursor->source, idxnum - 1);" << endl;
+	strm << "\tcursor->index = &index;" << endl;
+	strm << "\tif (argc < 1 || sqlite3_value_type(argv[0]) == SQLITE_NULL) {" << endl;
+	strm << "\t\tcursor->position = cursor->end = 0;" << endl;
+	strm << "\t\treturn SQLITE_OK;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tint value = sqlite3_value_int(argv[0]);" << endl;
+	strm << "\tcursor->position = std::lower_bound(index.begin(), index.end(), std::make_pair(value, (size_t)0)) - index.begin();" << endl;
+	strm << "\tcursor->end = std::upper_bound(index.begin(), index.end(), std::make_pair(value, (size_t)-1)) - index.begin();" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_next(sqlite3_vtab_cursor* cursor) {" << endl;
+	strm << "\t((vector_cursor<T>*)cursor)->position++;" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_eof(sqlite3_vtab_cursor* base) {" << endl;
+	strm << "\tvector_cursor<T>* cursor = (vector_cursor<T>*)base;" << endl;
+	strm << "\treturn cursor->position >= cursor->end;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_column(sqlite3_vtab_cursor* base, sqlite3_context* ctx, int column) {" << endl;
+	strm << "\tvector_cursor<T>* cursor = (vector_cursor<T>*)base;" << endl;
+	strm << "\tT::column(ctx, (*cursor->source->rows)[cursor->row()], column);" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "template <typename T>" << endl;
+	strm << "int vector_rowid(sqlite3_vtab_cursor* base, sqlite3_int64* result) {" << endl;
+	strm << "\t*result = (sqlite3_int64)((vector_cursor<T>*)base)->row();" << endl;
+	strm << "\treturn SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// zero initialized, so members added by newer sqlite versions stay null" << endl;
+	strm << "template <typename T>" << endl;
+	strm << "sqlite3_module vector_module() {" << endl;
+	strm << "\tsqlite3_module module = sqlite3_module();" << endl;
+	strm << "\tmodule.iVersion = 1;" << endl;
+	strm << "\tmodule.xConnect = vector_connect<T>;" << endl;
+	strm << "\tmodule.xBestIndex = vector_best_index<T>;" << endl;
+	strm << "\tmodule.xDisconnect = vector_disconnect<T>;" << endl;
+	strm << "\tmodule.xDestroy = vector_disconnect<T>;" << endl;
+	strm << "\tmodule.xOpen = vector_open<T>;" << endl;
+	strm << "\tmodule.xClose = vector_close<T>;" << endl;
+	strm << "\tmodule.xFilter = vector_filter<T>;" << endl;
+	strm << "\tmodule.xNext = vector_next<T>;" << endl;
+	strm << "\tmodule.xEof = vector_eof<T>;" << endl;
+	strm << "\tmodule.xColumn = vector_column<T>;" << endl;
+	strm << "\tmodule.xRowid = vector_rowid<T>;" << endl;
+	strm << "\treturn module;" << endl;
+	strm << "}" << endl << endl;
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		std::string traits = tabinfo.tablename + "_vector_traits";
+
+		stringstream schema;
+		schema << "create table x(";
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			const char* types[] = { "integer", "real", "blob", "text" };
+			if (j > 0) schema << ", ";
+			schema << finfo.fieldname << " " << types[finfo.type];
+		}
+		schema << ");";
+
+		strm << "struct " << traits << " {" << endl;
+		strm << "\ttypedef " << tabinfo.tablename << "data data;" << endl;
+		strm << "\tenum { key_column = " << primary_key_index(tabinfo) << ", column_count = " << tabinfo.fields.size() << " };" << endl << endl;
+		strm << "\tstatic const char* schema() { return \"" << schema.str() << "\"; }" << endl << endl;
+
+		bool hasindex = false;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			if (vector_indexed(tabinfo, j)) hasindex = true;
+		}
+
+		if (hasindex) {
+			strm << "\tstatic bool indexed(int column) {" << endl;
+			strm << "\t\tswitch (column) {" << endl;
+			for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+				if (vector_indexed(tabinfo, j))
+					strm << "\t\t\tcase " << j << ":" << endl;
+			}
+			strm << "\t\t\t\treturn true;" << endl;
+			strm << "\t\t\tdefault:" << endl;
+			strm << "\t\t\t\treturn false;" << endl;
+			strm << "\t\t}" << endl;
+			strm << "\t}" << endl << endl;
+
+			strm << "\tstatic int key(const data& row, int column) {" << endl;
+			strm << "\t\tswitch (column) {" << endl;
+			for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+				if (vector_indexed(tabinfo, j))
+					strm << "\t\t\tcase " << j << ": return row." << tabinfo.fields[j].fieldname << ";" << endl;
+			}
+			strm << "\t\t\tdefault: return 0;" << endl;
+			strm << "\t\t}" << endl;
+			strm << "\t}" << endl << endl;
+		} else {
+			strm << "\tstatic bool indexed(int) { return false; }" << endl;
+			strm << "\tstatic int key(const data&, int) { return 0; }" << endl << endl;
+		}
+
+		strm << "\tstatic void column(sqlite3_context* ctx, const data& row, int column) {" << endl;
+		strm << "\t\tswitch (column) {" << endl;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			strm << "\t\t\tcase " << j << ":" << endl;
+			switch (finfo.type) {
+				case dbgen_integer:
+					strm << "\t\t\t\tsqlite3_result_int(ctx, row." << finfo.fieldname << ");" << endl;
+					break;
+				case dbgen_float:
+					strm << "\t\t\t\tsqlite3_result_double(ctx, row." << finfo.fieldname << ");" << endl;
+					break;
+				case dbgen_text:
+					strm << "\t\t\t\tsqlite3_result_text(ctx, row." << finfo.fieldname << ".c_str(), (int)row." << finfo.fieldname << ".size(), SQLITE_TRANSIENT);" << endl;
+					break;
+				case dbgen_blob:
+					strm << "\t\t\t\tif (row." << finfo.fieldname << ".empty())" << endl;
+					strm << "\t\t\t\t\tsqlite3_result_zeroblob(ctx, 0);" << endl;
+					strm << "\t\t\t\telse" << endl;
+					strm << "\t\t\t\t\tsqlite3_result_blob(ctx, &row." << finfo.fieldname << ".front(), (int)row." << finfo.fieldname << ".size(), SQLITE_TRANSIENT);" << endl;
+					break;
+			}
+			strm << "\t\t\t\tbreak;" << endl;
+		}
+		strm << "\t\t}" << endl;
+		strm << "\t}" << endl;
+		strm << "};" << endl << endl;
+
+		strm << "sqlite3_module " << tabinfo.tablename << "_vector_module = vector_module<" << traits << ">();" << endl << endl;
+
+		strm << "// exposes rows as the read-only table name on db. rows are read in place" << endl;
+		strm << "// and must outlive the statements using the table. register again after" << endl;
+		strm << "// changing key values in place, which does not invalidate the index." << endl;
+		strm << "bool register_" << tabinfo.tablename << "_vector(sqlite3* db, const char* name, const std::vector<" << tabinfo.tablename << "data>& rows) {" << endl;
+		strm << "\tvector_source<" << traits << ">* source = new vector_source<" << traits << ">();" << endl;
+		strm << "\tsource->rows = &rows;" << endl;
+		strm << "\t// the source is deleted by sqlite, also when registering fails" << endl;
+		strm << "\treturn sqlite3_create_module_v2(db, name, &" << tabinfo.tablename << "_vector_module, source, vector_source_destroy<" << traits << ">) == SQLITE_OK;" << endl;
+		strm << "}" << endl << endl;
+	}
+}
+
+// with session based undo, the undo tables are recorded by the session
+// extension instead of undo triggers
+bool documentgen::undo_triggers(tableinfo& tabinfo) {
+	return tabinfo.generate_undo && !generate_session_undo;
+}
+
+void documentgen::generate_session_undo_header(std::ostream& strm) {
+	strm << "struct sqlite3;" << endl;
+	strm << "struct undo_history;" << endl << endl;
+
+	strm << "undo_history* open_undo_history(sqlite3* db);" << endl;
+	strm << "void close_undo_history(undo_history* history);" << endl;
+	strm << "void enable_undo_history(undo_history* history, bool enable);" << endl;
+	strm << "bool commit_undo_step(undo_history* history);" << endl;
+	strm << "bool apply_undo(undo_history* history);" << endl;
+	strm << "bool apply_redo(undo_history* history);" << endl;
+	strm << "bool can_undo(undo_history* history);" << endl;
+	strm << "bool can_redo(undo_history* history);" << endl;
+	strm << "size_t undo_history_bytes(undo_history* history);" << endl << endl;
+}
+
+// each undo step is the binary changeset recorded by the session between two
+// calls to commit_undo_step(). undo applies the inverted changeset and redo
+// the changeset itself, with recording paused.
+void documentgen::generate_session_undo_implementation(std::ostream& strm) {
+	strm << "struct undo_history {" << endl;
+	strm << "\tsqlite3* db;" << endl;
+	strm << "\tsqlite3_session* session;" << endl;
+	strm << "\tbool enabled;" << endl;
+	strm << "\tstd::vector<std::vector<unsigned char> > undo;" << endl;
+	strm << "\tstd::vector<std::vector<unsigned char> > redo;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "// records every table in database_tables. sharded tables live in the" << endl;
+	strm << "// attached shard databases and are not recorded." << endl;
+	strm << "bool start_undo_session(undo_history* history) {" << endl;
+	strm << "\tif (sqlite3session_create(history->db, \"main\", &history->session) != SQLITE_OK) {" << endl;
+	strm << "\t\thistory->session = 0;" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tbool result = true;" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (!tables[i].shardkey.empty()) continue;
+		strm << "\tresult = result && sqlite3session_attach(history->session, \"" << tables[i].tablename << "\") == SQLITE_OK;" << endl;
+	}
+	strm << "\tif (!result) {" << endl;
+	strm << "\t\tsqlite3session_delete(history->session);" << endl;
+	strm << "\t\thistory->session = 0;" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3session_enable(history->session, history->enabled ? 1 : 0);" << endl;
+	strm << "\treturn true;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "undo_history* open_undo_history(sqlite3* db) {" << endl;
+	strm << "\tundo_history* history = new undo_history();" << endl;
+	strm << "\thistory->db = db;" << endl;
+	strm << "\thistory->session = 0;" << endl;
+	strm << "\thistory->enabled = true;" << endl;
+	strm << "\tif (!start_undo_session(history)) {" << endl;
+	strm << "\t\tclose_undo_history(history);" << endl;
+	strm << "\t\treturn 0;" << endl;
+	strm << "\t}" << endl;
+	strm << "\treturn history;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void close_undo_history(undo_history* history) {" << endl;
+	strm << "\tif (history->session)" << endl;
+	strm << "\t\tsqlite3session_delete(history->session);" << endl;
+	strm << "\tdelete history;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void enable_undo_history(undo_history* history, bool enable) {" << endl;
+	strm << "\thistory->enabled = enable;" << endl;
+	strm << "\tif (history->session)" << endl;
+	strm << "\t\tsqlite3session_enable(history->session, enable ? 1 : 0);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// ends the current undo step. empty steps are not recorded. if a new" << endl;
+	strm << "// session could not be started, it is retried here and changes made in" << endl;
+	strm << "// the meantime are not recorded." << endl;
+	strm << "bool commit_undo_step(undo_history* history) {" << endl;
+	strm << "\tif (!history->session)" << endl;
+	strm << "\t\treturn start_undo_session(history);" << endl;
+	strm << "\tif (sqlite3session_isempty(history->session))" << endl;
+	strm << "\t\treturn true;" << endl;
+	strm << "\tint size = 0;" << endl;
+	strm << "\tvoid* changeset = 0;" << endl;
+	strm << "\tif (sqlite3session_changeset(history->session, &size, &changeset) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tif (size > 0) {" << endl;
+	strm << "\t\thistory->undo.push_back(std::vector<unsigned char>((unsigned char*)changeset, (unsigned char*)changeset + size));" << endl;
+	strm << "\t\thistory->redo.clear();" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_free(changeset);" << endl;
+	strm << "\tsqlite3session_delete(history->session);" << endl;
+	strm << "\thistory->session = 0;" << endl;
+	strm << "\treturn start_undo_session(history);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// rows already removed by a cascade trigger are skipped, other conflicts" << endl;
+	strm << "// roll back the step" << endl;
+	strm << "extern \"C\" int undo_history_conflict(void*, int conflict, sqlite3_changeset_iter*) {" << endl;
+	strm << "\treturn conflict == SQLITE_CHANGESET_NOTFOUND ? SQLITE_CHANGESET_OMIT : SQLITE_CHANGESET_ABORT;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool apply_undo_changeset(undo_history* history, std::vector<unsigned char>& changeset, bool invert) {" << endl;
+	strm << "\tint size = (int)changeset.size();" << endl;
+	strm << "\tvoid* data = &changeset.front();" << endl;
+	strm << "\tvoid* inverted = 0;" << endl;
+	strm << "\tif (invert && sqlite3changeset_invert(size, data, &size, &inverted) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3session_enable(history->session, 0);" << endl;
+	strm << "\tint result = sqlite3changeset_apply(history->db, size, invert ? inverted : data, 0, undo_history_conflict, 0);" << endl;
+	strm << "\tsqlite3session_enable(history->session, history->enabled ? 1 : 0);" << endl;
+	strm << "\tsqlite3_free(inverted);" << endl;
+	strm << "\treturn result == SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool apply_undo(undo_history* history) {" << endl;
+	strm << "\tif (!commit_undo_step(history) || history->undo.empty())" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tif (!apply_undo_changeset(history, history->undo.back(), true))" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\thistory->redo.push_back(std::vector<unsigned char>());" << endl;
+	strm << "\thistory->redo.back().swap(history->undo.back());" << endl;
+	strm << "\thistory->undo.pop_back();" << endl;
+	strm << "\treturn true;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool apply_redo(undo_history* history) {" << endl;
+	strm << "\tif (!commit_undo_step(history) || history->redo.empty())" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tif (!apply_undo_changeset(history, history->redo.back(), false))" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\thistory->undo.push_back(std::vector<unsigned char>());" << endl;
+	strm << "\thistory->undo.back().swap(history->redo.back());" << endl;
+	strm << "\thistory->redo.pop_back();" << endl;
+	strm << "\treturn true;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool can_undo(undo_history* history) {" << endl;
+	strm << "\treturn !history->undo.empty() || (history->session && !sqlite3session_isempty(history->session));" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool can_redo(undo_history* history) {" << endl;
+	strm << "\treturn !history->redo.empty();" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "size_t undo_history_bytes(undo_history* history) {" << endl;
+	strm << "\tsize_t result = 0;" << endl;
+	strm << "\tfor (size_t i = 0; i < history->undo.size(); i++) result += history->undo[i].size();" << endl;
+	strm << "\tfor (size_t i = 0; i < history->redo.size(); i++) result += history->redo[i].size();" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+}
+
+// returns the sql expression quoting the old value of a column in undo
+// queries. with deduplication, large text and blob values are replaced by
+// a reference into the undo value store.
+string documentgen::undo_quote(fieldinfo& finfo) {
+	string value = "old." + finfo.fieldname;
+	if (undo_dedup_bytes == 0 || (finfo.type != dbgen_text && finfo.type != dbgen_blob))
+		return "quote(" + value + ")";
+	stringstream result;
+	result << "case when typeof(" << value << ") in ('blob', 'text') and length(" << value << ") >= " << undo_dedup_bytes;
+	result << " then dbgenpp_undo_ref(" << value << ") else quote(" << value << ") end";
+	return result.str();
+}
+
+// returns expr as a value of an undo query: concatenated into the sql
+// expression building the query, or with plan set a parameter of the
+// statement the query plan check prepares
+string undo_value(const string& expr, bool plan) {
+	return plan ? "?" : "'||" + expr + "||'";
+}
+
+// the undo queries of an insert, a delete and an update. they return the
+// sql expression recorded by the undo trigger, or with plan set the same
+// query with parameters for the values, as the query plan check prepares it.
+string documentgen::undo_insert_query(tableinfo& tabinfo, bool plan) {
+	string key = tabinfo.fields[primary_key_index(tabinfo)].fieldname;
+	string text = "delete from " + tabinfo.tablename + " where " + key + " = " + undo_value("quote(new." + key + ")", plan) + ";";
+	return plan ? text : "'" + text + "'";
+}
+
+string documentgen::undo_delete_query(tableinfo& tabinfo, bool plan) {
+	string text = "insert into " + tabinfo.tablename + " values(";
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (i > 0) text += ", ";
+		text += undo_value(undo_quote(tabinfo.fields[i]), plan);
+	}
+	text += ");";
+	return plan ? text : "'" + text + "'";
+}
+
+string documentgen::undo_update_query(tableinfo& tabinfo, bool plan) {
+	string key = tabinfo.fields[primary_key_index(tabinfo)].fieldname;
+	string text = "update " + tabinfo.tablename + " set ";
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (i > 0) text += ", ";
+		text += tabinfo.fields[i].fieldname + " = " + undo_value(undo_quote(tabinfo.fields[i]), plan);
+	}
+	text += " where " + key + " = " + undo_value("quote(old." + key + ")", plan) + ";";
+	return plan ? text : "'" + text + "'";
+}
+
+void documentgen::generate_undo_values_header(std::ostream& strm) {
+	strm << "struct sqlite3;" << endl << endl;
+	strm << "void release_undo_values(sqlite3* db, const char* undoquery);" << endl;
+	strm << "size_t undo_value_bytes(sqlite3* db);" << endl << endl;
+}
+
+// large undo values are stored once per content hash with a reference count,
+// in a store owned by the connection: it is the user data of the store's sql
+// functions and is deleted when the connection is closed. an undo query
+// refers to a value as dbgenpp_undo_value(key). the keys taken while an undo
+// query is built are kept as a record of that query, which
+// release_undo_values() finds by the query text when the undo history drops
+// it. the trigger recording the query also inserts the record's id into the
+// temp table dbgenpp_undo_records, so the row disappears when the statement,
+// savepoint or transaction is rolled back, and the record is released.
+void documentgen::generate_undo_values_implementation(std::ostream& strm) {
+	strm << "struct undo_value {" << endl;
+	strm << "\tint type;" << endl;
+	strm << "\tstd::string data;" << endl;
+	strm << "\tint refs;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "// the value references of one recorded undo query" << endl;
+	strm << "struct undo_record {" << endl;
+	strm << "\tlong long id;" << endl;
+	strm << "\tstd::vector<unsigned long long> keys;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "typedef std::multimap<std::string, undo_record> undo_records;" << endl << endl;
+
+	strm << "struct undo_value_store {" << endl;
+	strm << "\tsqlite3* db;" << endl;
+	strm << "\tstd::map<unsigned long long, undo_value> values;" << endl;
+	strm << "\tundo_records records; // by undo query" << endl;
+	strm << "\tstd::vector<unsigned long long> taken; // by the undo query being built" << endl;
+	strm << "\tstd::vector<undo_records::iterator> unconfirmed; // not known to be committed" << endl;
+	strm << "\tlong long recorded; // id of the last record, until its row is inserted" << endl;
+	strm << "\tlong long next_record;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "extern \"C\" void undo_value_store_destroy(void* store) {" << endl;
+	strm << "\tdelete (undo_value_store*)store;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void release_undo_value(undo_value_store* store, unsigned long long key) {" << endl;
+	strm << "\tstd::map<unsigned long long, undo_value>::iterator i = store->values.find(key);" << endl;
+	strm << "\tif (i != store->values.end() && --i->second.refs == 0)" << endl;
+	strm << "\t\tstore->values.erase(i);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void release_undo_record(undo_value_store* store, undo_records::iterator record) {" << endl;
+	strm << "\tfor (size_t i = 0; i < record->second.keys.size(); i++) {" << endl;
+	strm << "\t\trelease_undo_value(store, record->second.keys[i]);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tstore->records.erase(record);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// releases the unconfirmed records whose row was rolled back. the caller's" << endl;
+	strm << "// statement is the only one running, so every record has its row unless" << endl;
+	strm << "// it was rolled back. outside of a transaction the remaining records are" << endl;
+	strm << "// committed and their rows are no longer needed." << endl;
+	strm << "void check_undo_records(undo_value_store* store) {" << endl;
+	strm << "\tif (store->unconfirmed.empty())" << endl;
+	strm << "\t\treturn;" << endl;
+	strm << "\tint running = 0;" << endl;
+	strm << "\tfor (sqlite3_stmt* stmt = sqlite3_next_stmt(store->db, 0); stmt; stmt = sqlite3_next_stmt(store->db, stmt)) {" << endl;
+	strm << "\t\tif (sqlite3_stmt_busy(stmt) && ++running > 1)" << endl;
+	strm << "\t\t\treturn;" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(store->db, \"select 1 from temp.dbgenpp_undo_records where record = ?1;\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn;" << endl;
+	strm << "\tbool committed = sqlite3_get_autocommit(store->db) != 0;" << endl;
+	strm << "\tstd::vector<undo_records::iterator> unconfirmed;" << endl;
+	strm << "\tfor (size_t i = 0; i < store->unconfirmed.size(); i++) {" << endl;
+	strm << "\t\tsqlite3_bind_int64(stmt, 1, store->unconfirmed[i]->second.id);" << endl;
+	strm << "\t\tint result = sqlite3_step(stmt);" << endl;
+	strm << "\t\tsqlite3_reset(stmt);" << endl;
+	strm << "\t\tif (result == SQLITE_DONE)" << endl;
+	strm << "\t\t\trelease_undo_record(store, store->unconfirmed[i]);" << endl;
+	strm << "\t\telse if (result != SQLITE_ROW || !committed)" << endl;
+	strm << "\t\t\tunconfirmed.push_back(store->unconfirmed[i]);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\tstore->unconfirmed.swap(unconfirmed);" << endl;
+	strm << "\tif (committed && store->unconfirmed.empty())" << endl;
+	strm << "\t\tsqlite3_exec(store->db, \"delete from temp.dbgenpp_undo_records;\", 0, 0, 0);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "extern \"C\" void dbgenpp_undo_ref(sqlite3_context* ctx, int, sqlite3_value** row) {" << endl;
+	strm << "\tundo_value_store* store = (undo_value_store*)sqlite3_user_data(ctx);" << endl;
+	strm << "\tint type = sqlite3_value_type(row[0]);" << endl;
+	strm << "\tconst char* data = type == SQLITE_BLOB ? (const char*)sqlite3_value_blob(row[0]) : (const char*)sqlite3_value_text(row[0]);" << endl;
+	strm << "\tstd::string value(data ? data : \"\", sqlite3_value_bytes(row[0]));" << endl << endl;
+	strm << "\tunsigned long long key = 14695981039346656037ULL ^ (unsigned long long)type;" << endl;
+	strm << "\tfor (size_t i = 0; i < value.size(); i++) {" << endl;
+	strm << "\t\tkey ^= (unsigned char)value[i];" << endl;
+	strm << "\t\tkey *= 1099511628211ULL;" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\tstd::map<unsigned long long, undo_value>::iterator i;" << endl;
+	strm << "\twhile ((i = store->values.find(key)) != store->values.end() && (i->second.type != type || i->second.data != value)) {" << endl;
+	strm << "\t\tkey++;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (i == store->values.end()) {" << endl;
+	strm << "\t\tundo_value& stored = store->values[key];" << endl;
+	strm << "\t\tstored.type = type;" << endl;
+	strm << "\t\tstored.data.swap(value);" << endl;
+	strm << "\t\tstored.refs = 1;" << endl;
+	strm << "\t} else" << endl;
+	strm << "\t\ti->second.refs++;" << endl;
+	strm << "\tstore->taken.push_back(key);" << endl << endl;
+	strm << "\tstd::stringstream reference;" << endl;
+	strm << "\treference << \"dbgenpp_undo_value(\" << (long long)key << \")\";" << endl;
+	strm << "\tsqlite3_result_text(ctx, reference.str().c_str(), -1, SQLITE_TRANSIENT);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "extern \"C\" void dbgenpp_undo_value(sqlite3_context* ctx, int, sqlite3_value** row) {" << endl;
+	strm << "\tundo_value_store* store = (undo_value_store*)sqlite3_user_data(ctx);" << endl;
+	strm << "\tstd::map<unsigned long long, undo_value>::iterator i = store->values.find((unsigned long long)sqlite3_value_int64(row[0]));" << endl;
+	strm << "\tif (i == store->values.end())" << endl;
+	strm << "\t\tsqlite3_result_error(ctx, \"undo value not found\", -1);" << endl;
+	strm << "\telse if (i->second.type == SQLITE_BLOB)" << endl;
+	strm << "\t\tsqlite3_result_blob(ctx, i->second.data.data(), (int)i->second.data.size(), SQLITE_TRANSIENT);" << endl;
+	strm << "\telse" << endl;
+	strm << "\t\tsqlite3_result_text(ctx, i->second.data.data(), (int)i->second.data.size(), SQLITE_TRANSIENT);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// passes the undo query through and keeps the keys taken while it was built" << endl;
+	strm << "// as its record" << endl;
+	strm << "extern \"C\" void dbgenpp_undo_query(sqlite3_context* ctx, int, sqlite3_value** row) {" << endl;
+	strm << "\tundo_value_store* store = (undo_value_store*)sqlite3_user_data(ctx);" << endl;
+	strm << "\tstore->recorded = 0;" << endl;
+	strm << "\tif (!store->taken.empty()) {" << endl;
+	strm << "\t\tconst char* undoquery = (const char*)sqlite3_value_text(row[0]);" << endl;
+	strm << "\t\tundo_records::iterator record = store->records.insert(std::make_pair(std::string(undoquery ? undoquery : \"\"), undo_record()));" << endl;
+	strm << "\t\trecord->second.id = store->recorded = ++store->next_record;" << endl;
+	strm << "\t\trecord->second.keys.swap(store->taken);" << endl;
+	strm << "\t\tstore->unconfirmed.push_back(record);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_result_value(ctx, row[0]);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "extern \"C\" void dbgenpp_undo_pending(sqlite3_context* ctx, int, sqlite3_value**) {" << endl;
+	strm << "\tundo_value_store* store = (undo_value_store*)sqlite3_user_data(ctx);" << endl;
+	strm << "\tsqlite3_result_int(ctx, store->recorded != 0);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "extern \"C\" void dbgenpp_undo_recorded(sqlite3_context* ctx, int, sqlite3_value**) {" << endl;
+	strm << "\tundo_value_store* store = (undo_value_store*)sqlite3_user_data(ctx);" << endl;
+	strm << "\tsqlite3_result_int64(ctx, store->recorded);" << endl;
+	strm << "\tstore->recorded = 0;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// queries recorded several times have the same keys, so any of their" << endl;
+	strm << "// records can be released" << endl;
+	strm << "extern \"C\" void dbgenpp_release_undo_values(sqlite3_context* ctx, int, sqlite3_value** row) {" << endl;
+	strm << "\tundo_value_store* store = (undo_value_store*)sqlite3_user_data(ctx);" << endl;
+	strm << "\tcheck_undo_records(store);" << endl;
+	strm << "\tconst char* undoquery = (const char*)sqlite3_value_text(row[0]);" << endl;
+	strm << "\tundo_records::iterator record = store->records.find(std::string(undoquery ? undoquery : \"\"));" << endl;
+	strm << "\tif (record != store->records.end()) {" << endl;
+	strm << "\t\tstd::vector<undo_records::iterator>::iterator i = std::find(store->unconfirmed.begin(), store->unconfirmed.end(), record);" << endl;
+	strm << "\t\tif (i != store->unconfirmed.end())" << endl;
+	strm << "\t\t\tstore->unconfirmed.erase(i);" << endl;
+	strm << "\t\trelease_undo_record(store, record);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_result_null(ctx);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "extern \"C\" void dbgenpp_undo_value_bytes(sqlite3_context* ctx, int, sqlite3_value**) {" << endl;
+	strm << "\tundo_value_store* store = (undo_value_store*)sqlite3_user_data(ctx);" << endl;
+	strm << "\tcheck_undo_records(store);" << endl;
+	strm << "\tsqlite3_int64 result = 0;" << endl;
+	strm << "\tfor (std::map<unsigned long long, undo_value>::iterator i = store->values.begin(); i != store->values.end(); ++i) {" << endl;
+	strm << "\t\tresult += i->second.data.size();" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_result_int64(ctx, result);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void create_undo_values(sqlite3* db) {" << endl;
+	strm << "\tsqlite3_exec(db, \"create temp table if not exists dbgenpp_undo_records (record integer primary key); delete from temp.dbgenpp_undo_records;\", 0, 0, 0);" << endl;
+	strm << "\tundo_value_store* store = new undo_value_store();" << endl;
+	strm << "\tstore->db = db;" << endl;
+	strm << "\tsqlite3_create_function_v2(db, \"dbgenpp_undo_ref\", 1, SQLITE_ANY, store, dbgenpp_undo_ref, 0, 0, undo_value_store_destroy);" << endl;
+	strm << "\tsqlite3_create_function(db, \"dbgenpp_undo_value\", 1, SQLITE_ANY, store, dbgenpp_undo_value, 0, 0);" << endl;
+	strm << "\tsqlite3_create_function(db, \"dbgenpp_undo_query\", 1, SQLITE_ANY, store, dbgenpp_undo_query, 0, 0);" << endl;
+	strm << "\tsqlite3_create_function(db, \"dbgenpp_undo_pending\", 0, SQLITE_ANY, store, dbgenpp_undo_pending, 0, 0);" << endl;
+	strm << "\tsqlite3_create_function(db, \"dbgenpp_undo_recorded\", 0, SQLITE_ANY, store, dbgenpp_undo_recorded, 0, 0);" << endl;
+	strm << "\tsqlite3_create_function(db, \"dbgenpp_release_undo_values\", 1, SQLITE_ANY, store, dbgenpp_release_undo_values, 0, 0);" << endl;
+	strm << "\tsqlite3_create_function(db, \"dbgenpp_undo_value_bytes\", 0, SQLITE_ANY, store, dbgenpp_undo_value_bytes, 0, 0);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "void release_undo_values(sqlite3* db, const char* undoquery) {" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"select dbgenpp_release_undo_values(?1);\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+	strm << "\t\tsqlite3_bind_text(stmt, 1, undoquery, -1, SQLITE_STATIC);" << endl;
+	strm << "\t\tsqlite3_step(stmt);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "size_t undo_value_bytes(sqlite3* db) {" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tsize_t result = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"select dbgenpp_undo_value_bytes();\", -1, &stmt, 0) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)" << endl;
+	strm << "\t\tresult = (size_t)sqlite3_column_int64(stmt, 0);" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+}
+
+// the callback rows are allocated from the arena of the calling thread.
+// the rows decoded by a notify callback are locals of the callback, so the
+// arena is released when the outermost callback on the thread returns. the
+// arena starts with a buffer of its own, which release() rewinds to, so only
+// rows outgrowing it allocate blocks from the heap, which release() frees.
+void documentgen::generate_row_arena_implementation(std::ostream& strm) {
+	strm << "struct row_arena {" << endl;
+	strm << "\tunsigned char buffer[64 * 1024];" << endl;
+	strm << "\tstd::pmr::monotonic_buffer_resource resource;" << endl;
+	strm << "\tint depth; // active callbacks on the thread" << endl << endl;
+	strm << "\trow_arena() : resource(buffer, sizeof buffer), depth(0) {}" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "thread_local row_arena current_row_arena;" << endl << endl;
+
+	strm << "namespace dbgenpp {" << endl;
+	strm << "void read_value(sqlite3_value* value, std::pmr::string& result) {" << endl;
+	fieldinfo text;
+	text.type = dbgen_text;
+	generate_read_value(text, "result", "value", "\t", strm);
+	strm << "}" << endl << endl;
+	strm << "void read_value(sqlite3_value* value, std::pmr::vector<unsigned char>& result) {" << endl;
+	fieldinfo blob;
+	blob.type = dbgen_blob;
+	generate_read_value(blob, "result", "value", "\t", strm);
+	strm << "}" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "struct row_arena_scope {" << endl;
+	strm << "\trow_arena_scope() { current_row_arena.depth++; }" << endl;
+	strm << "\t~row_arena_scope() {" << endl;
+	strm << "\t\tif (--current_row_arena.depth == 0)" << endl;
+	strm << "\t\t\tcurrent_row_arena.resource.release();" << endl;
+	strm << "\t}" << endl;
+	strm << "};" << endl << endl;
+
+	// the run time unpacks the trigger arguments into default constructed
+	// rows of its template argument, which for these types draw from the arena
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!has_notify_callback(tabinfo))
+			continue;
+		string datatype = tabinfo.tablename + "data";
+		strm << "struct " << tabinfo.tablename << "_arena_row : " << datatype << " {" << endl;
+		strm << "\t" << tabinfo.tablename << "_arena_row() : " << datatype << "(&current_row_arena.resource) {}" << endl;
+		strm << "};" << endl << endl;
+	}
+}
+
+void documentgen::generate_query_plan_check_header(std::ostream& strm) {
+	strm << "struct query_plan_report {" << endl;
+	strm << "\tint statements;" << endl;
+	strm << "\tint scans; // statements whose plan scans a table" << endl;
+	strm << "\tint failures; // statements which cannot be prepared" << endl;
+	strm << "};" << endl << endl;
+	strm << "bool verify_query_plans(std::ostream& err, query_plan_report* report = 0);" << endl << endl;
+}
+
+// query is a c++ expression evaluating to the statement text, so the check
+// uses the same constant the generated code prepares. scan is the c++
+// expression of the table the statement reads completely by design, or 0.
+void documentgen::add_query_plan(const string& query, const string& scan) {
+	for (size_t i = 0; i < query_plans.size(); i++) {
+		if (query_plans[i].first == query) return;
+	}
+	query_plans.push_back(std::make_pair(query, scan));
+}
+
+// adds a statement which is not a constant of its own in the generated code,
+// like the statements in trigger bodies
+void documentgen::add_query_plan_text(const string& sql, const string& scan) {
+	add_query_plan("\"" + cpp_escape(sql) + "\"", scan.empty() ? "0" : "\"" + scan + "\"");
+}
+
+// lists the statements which look up rows by a key: the single record
+// statements of the table traits, the statements run by the triggers and
+// recorded by undo triggers, and the statements of the navigation, upsert,
+// cursor, fulltext search and bulk session functions. the statements built
+// at run time are checked with all columns selected. sharded tables are not
+// created by tables_script and are skipped.
+void documentgen::generate_query_plan_check_implementation(std::ostream& strm) {
+	std::vector<std::pair<string, string> > plans;
+	plans.swap(query_plans);
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!tabinfo.shardkey.empty())
+			continue;
+		string traits = tabinfo.tablename + "data::table_traits::";
+		add_query_plan(traits + "select_query()");
+		add_query_plan(traits + "update_query()");
+		add_query_plan(traits + "delete_query()");
+		if (generate_upsert && upsert_table(tabinfo))
+			add_query_plan(traits + "upsert_query()");
+	}
+	query_plans.insert(query_plans.end(), plans.begin(), plans.end());
+
+	strm << "struct query_plan_statement {" << endl;
+	strm << "	const char* query;" << endl;
+	strm << "	const char* scan; // table the statement reads completely, or 0" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "const query_plan_statement query_plan_statements[] = {" << endl;
+	for (size_t i = 0; i < query_plans.size(); i++) {
+		strm << "	{ " << query_plans[i].first << ", " << query_plans[i].second << " }," << endl;
+	}
+	strm << "	{ 0, 0 }" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "// a virtual table is searched when its module used a constraint, which" << endl;
+	strm << "// shows as text after the index number" << endl;
+	strm << "bool query_plan_scans(const char* detail, const char* scan) {" << endl;
+	strm << "	if (strncmp(detail, \"SCAN \", 5) != 0)" << endl;
+	strm << "		return false;" << endl;
+	strm << "	const char* table = detail + 5;" << endl;
+	strm << "	if (strncmp(table, \"TABLE \", 6) == 0)" << endl;
+	strm << "		table += 6;" << endl;
+	strm << "	size_t length = strcspn(table, \" \");" << endl;
+	strm << "	if (scan != 0 && strlen(scan) == length && strncmp(table, scan, length) == 0)" << endl;
+	strm << "		return false;" << endl;
+	strm << "	const char* index = strstr(table, \" VIRTUAL TABLE INDEX \");" << endl;
+	strm << "	if (index == 0)" << endl;
+	strm << "		return true;" << endl;
+	strm << "	index = strchr(index, ':');" << endl;
+	strm << "	return index == 0 || index[1] == 0;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// a statement which cannot be prepared is a broken generated statement" << endl;
+	strm << "// rather than a missing index, so it is reported and counted apart" << endl;
+	strm << "bool verify_query_plan(sqlite3* db, const char* statement, const char* scan, query_plan_report& report, std::ostream& err) {" << endl;
+	strm << "	std::string query = std::string(\"explain query plan \") + statement;" << endl;
+	strm << "	sqlite3_stmt* stmt = 0;" << endl;
+	strm << "	report.statements++;" << endl;
+	strm << "	if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, 0) != SQLITE_OK) {" << endl;
+	strm << "		err << \"cannot prepare \" << statement << \": \" << sqlite3_errmsg(db) << std::endl;" << endl;
+	strm << "		report.failures++;" << endl;
+	strm << "		return false;" << endl;
+	strm << "	}" << endl;
+	strm << "	bool result = true;" << endl;
+	strm << "	while (sqlite3_step(stmt) == SQLITE_ROW) {" << endl;
+	strm << "		const char* detail = (const char*)sqlite3_column_text(stmt, 3);" << endl;
+	strm << "		if (detail && query_plan_scans(detail, scan)) {" << endl;
+	strm << "			err << \"table scan in \" << statement << \": \" << detail << std::endl;" << endl;
+	strm << "			result = false;" << endl;
+	strm << "		}" << endl;
+	strm << "	}" << endl;
+	strm << "	sqlite3_finalize(stmt);" << endl;
+	strm << "	if (!result)" << endl;
+	strm << "		report.scans++;" << endl;
+	strm << "	return result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// creates the tables in an in-memory database and reports every statement in" << endl;
+	strm << "// query_plan_statements whose query plan scans a table instead of searching" << endl;
+	strm << "// it by an index, and every statement which cannot be prepared. returns" << endl;
+	strm << "// false if any statement scans or fails to prepare, and counts both in" << endl;
+	strm << "// report when it is not null." << endl;
+	strm << "bool verify_query_plans(std::ostream& err, query_plan_report* report) {" << endl;
+	strm << "	query_plan_report counts = query_plan_report();" << endl;
+	strm << "	sqlite3* db = 0;" << endl;
+	strm << "	if (sqlite3_open(\":memory:\", &db) != SQLITE_OK || sqlite3_exec(db, tables_script, 0, 0, 0) != SQLITE_OK";
+	if (generate_navigation)
+		strm << " ||" << endl << "		sqlite3_exec(db, navigation_keys_script, 0, 0, 0) != SQLITE_OK";
+	if (generate_bulk_sessions)
+		strm << " ||" << endl << "		sqlite3_exec(db, create_bulk_snapshots_script, 0, 0, 0) != SQLITE_OK";
+	strm << ") {" << endl;
+	strm << "		err << \"cannot create tables: \" << sqlite3_errmsg(db) << std::endl;" << endl;
+	strm << "		sqlite3_close(db);" << endl;
+	strm << "		counts.failures++;" << endl;
+	strm << "		if (report)" << endl;
+	strm << "			*report = counts;" << endl;
+	strm << "		return false;" << endl;
+	strm << "	}" << endl << endl;
+	strm << "	bool result = true;" << endl;
+	strm << "	for (size_t i = 0; query_plan_statements[i].query != 0; i++) {" << endl;
+	strm << "		result &= verify_query_plan(db, query_plan_statements[i].query, query_plan_statements[i].scan, counts, err);" << endl;
+	strm << "	}" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		string traits = tabinfo.tablename + "data::table_traits::";
+		string arguments = traits + "name(), " + tabinfo.tablename + "_column_names, " + traits + "column_count, " + traits + "key_parameter - 1, ~0ULL";
+		if (generate_upsert && upsert_table(tabinfo) && tabinfo.fields.size() > 1)
+			strm << "	result &= verify_query_plan(db, update_columns_query(" << arguments << ").c_str(), 0, counts, err);" << endl;
+		if (generate_cursors && cursor_table(tabinfo))
+			strm << "	result &= verify_query_plan(db, table_cursor_query(" << arguments << ", 0).c_str(), 0, counts, err);" << endl;
+	}
+	strm << "	sqlite3_close(db);" << endl;
+	strm << "	if (report)" << endl;
+	strm << "		*report = counts;" << endl;
+	strm << "	return result;" << endl;
+	strm << "}" << endl << endl;
+}
+
+void documentgen::generate_document_implementation(const std::string& prefix, std::ostream& strm) {
+	strm << "// (automatically generated)" << endl << endl;
+	query_plans.clear();
+
+	if (generate_instrumentation)
+		generate_stats_implementation(strm);
+
+	if (generate_bulk_sessions)
+		strm << "#include <cstring>" << endl << endl;
+
+	if (has_sharded_tables())
+		strm << "#include <sstream>" << endl << endl;
+
+	if (has_snapshot_tables()) {
+		strm << "#include <cstdio>" << endl;
+		strm << "#include <cstring>" << endl;
+		strm << "#include <string>" << endl;
+		// only the file mapping functions are needed, so keep windows.h from
+		// defining min/max and pulling in the rarely used headers
+		strm << "#if defined(_WIN32)" << endl;
+		strm << "#ifndef WIN32_LEAN_AND_MEAN" << endl;
+		strm << "#define WIN32_LEAN_AND_MEAN" << endl;
+		strm << "#define DBGENPP_LEAN_AND_MEAN" << endl;
+		strm << "#endif" << endl;
+		strm << "#ifndef NOMINMAX" << endl;
+		strm << "#define NOMINMAX" << endl;
+		strm << "#define DBGENPP_NOMINMAX" << endl;
+		strm << "#endif" << endl;
+		strm << "#include <windows.h>" << endl;
+		strm << "#ifdef DBGENPP_LEAN_AND_MEAN" << endl;
+		strm << "#undef WIN32_LEAN_AND_MEAN" << endl;
+		strm << "#undef DBGENPP_LEAN_AND_MEAN" << endl;
+		strm << "#endif" << endl;
+		strm << "#ifdef DBGENPP_NOMINMAX" << endl;
+		strm << "#undef NOMINMAX" << endl;
+		strm << "#undef DBGENPP_NOMINMAX" << endl;
+		strm << "#endif" << endl;
+		strm << "#else" << endl;
+		strm << "#include <sys/mman.h>" << endl;
+		strm << "#include <sys/stat.h>" << endl;
+		strm << "#include <fcntl.h>" << endl;
+		strm << "#include <unistd.h>" << endl;
+		strm << "#endif" << endl << endl;
+	}
+
+	if (generate_navigation)
+		strm << "#include <map>" << endl << endl;
+
+	if (generate_virtual_tables)
+		strm << "#include <algorithm>" << endl << endl;
+
+	if (undo_dedup_bytes > 0) {
+		strm << "#include <algorithm>" << endl;
+		strm << "#include <map>" << endl;
+		strm << "#include <sstream>" << endl;
+		strm << "#include <string>" << endl;
+		strm << "#include <utility>" << endl;
+		strm << "#include <vector>" << endl << endl;
+	}
+
+	if (generate_session_undo) {
+		strm << "#if !defined(SQLITE_ENABLE_SESSION) || !defined(SQLITE_ENABLE_PREUPDATE_HOOK)" << endl;
+		strm << "#error session_undo requires SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK" << endl;
+		strm << "#endif" << endl << endl;
+	}
+
+	if (generate_reader_pool) {
+		strm << "#include <mutex>" << endl;
+		strm << "#include <condition_variable>" << endl << endl;
+	}
+
+	if (generate_upsert) {
+		strm << "#include <map>" << endl;
+		strm << "#include <string>" << endl << endl;
+	}
+
+	if (generate_cursors) {
+		strm << "#include <climits>" << endl;
+		strm << "#include <string>" << endl << endl;
+	}
+
+	if (generate_query_plan_check) {
+		strm << "#include <cstring>" << endl;
+		strm << "#include <string>" << endl << endl;
+	}
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		generate_marshal_functions(tables[i], strm);
+	}
+
+	// column names by index, for statements built at run time
+	if (generate_upsert || generate_cursors) {
+		for (size_t i = 0; i < tables.size(); i++) {
+			tableinfo& tabinfo = tables[i];
+			if (!tabinfo.shardkey.empty()) continue;
+			strm << "const char* const " << tabinfo.tablename << "_column_names[] = { ";
+			for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+				if (j > 0) strm << ", ";
+				strm << "\"" << tabinfo.fields[j].fieldname << "\"";
+			}
+			strm << " };" << endl;
+		}
+		strm << endl;
+	}
+
+	if (generate_bulk_sessions) {
+		strm << "// returns 1 while a bulk session is active on the connection. called" << endl;
+		strm << "// with an argument to begin or end the session." << endl;
+		strm << "extern \"C\" void dbgenpp_bulk_session(sqlite3_context* ctx, int argc, sqlite3_value** row) {" << endl;
+		strm << "\tint* active = (int*)sqlite3_user_data(ctx);" << endl;
+		strm << "\tif (argc == 1)" << endl;
+		strm << "\t\t*active = sqlite3_value_int(row[0]);" << endl;
+		strm << "\tsqlite3_result_int(ctx, *active);" << endl;
+		strm << "}" << endl << endl;
+		strm << "extern \"C\" void dbgenpp_bulk_session_destroy(void* active) {" << endl;
+		strm << "\tdelete (int*)active;" << endl;
+		strm << "}" << endl << endl;
+	}
+
+	if (generate_row_arena)
+		generate_row_arena_implementation(strm);
+
+	if (undo_dedup_bytes > 0)
+		generate_undo_values_implementation(strm);
+
+	if (generate_extern_templates)
+		generate_extern_template_declarations(prefix, strm);
+
+	// generate functions which are used as trigger callbacks
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!has_notify_callback(tabinfo))
+			continue;
+		strm << "extern \"C\" void " << tables[i].tablename << "_notify_callback(sqlite3_context* ctx, int, sqlite3_value** row) {" << endl;
+		if (generate_instrumentation)
+			strm << "\tstats_scope stats(" << tabinfo.tablename << "_counters, sqlite3_value_int(row[0]));" << endl;
+		if (generate_row_arena) {
+			strm << "\trow_arena_scope scope;" << endl;
+			strm << "\tbool result = dbgenpp::table_notify_callback<" << tables[i].tablename << "_arena_row, document_event_data>(ctx, row);" << endl;
+		} else
+			strm << "\tbool result = dbgenpp::table_notify_callback<" << tables[i].tablename << "data, document_event_data>(ctx, row);" << endl;
+		strm << "\tsqlite3_result_int(ctx, result?1:0);" << endl;
+		strm << "}" << endl;
+		strm << endl;
+
+		if (generate_instrumentation && undo_triggers(tabinfo)) {
+			strm << "extern \"C\" void " << tabinfo.tablename << "_undo_stats(sqlite3_context* ctx, int, sqlite3_value** row) {" << endl;
+			strm << "\ttable_event_counters& counters = " << tabinfo.tablename << "_counters.events[sqlite3_value_int(row[0])];" << endl;
+			strm << "\tcounters.undo_records.fetch_add(1, std::memory_order_relaxed);" << endl;
+			strm << "\tcounters.undo_bytes.fetch_add(sqlite3_value_bytes(row[1]), std::memory_order_relaxed);" << endl;
+			strm << "\tsqlite3_result_value(ctx, row[1]);" << endl;
+			strm << "}" << endl;
+			strm << endl;
+		}
+	}
+
+	// generate a function which generates a query that generates tables in an empty database.
+	// without a prefix the query is the constant tables_script.
+	sqlscript tablesscript;
+	stringstream prefixquery;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!tabinfo.shardkey.empty())
+			continue;
+		string columns = column_definitions(tabinfo);
+		tablesscript.statement("create table " + tabinfo.tablename + " (" + columns + ");");
+		prefixquery << "\tquery << \"create table \" << prefix << \"" << tabinfo.tablename << " (" << columns << ");\" << endl;" << endl;
+
+		// create indexes for foreign keys to prevent full table scans during enforcing
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& finfo = tabinfo.fields[j];
+			if (finfo.keytable.empty()) {
+				continue;
+			}
+			std::string indexname = foreign_key_index_name(tabinfo, finfo);
+			tablesscript.statement("create index " + indexname + " ON " + tabinfo.tablename + "(" + finfo.fieldname + ");");
+			prefixquery << "\tquery << \"create index \" << prefix << \"" << indexname << " ON ";
+			prefixquery << tabinfo.tablename << "(" << finfo.fieldname << ");\" << endl;" << endl;
+		}
+
+		if (has_fulltext(tabinfo)) {
+			tablesscript.statement(fulltext_table_definition(tabinfo));
+			prefixquery << "\tquery << \"create virtual table \" << prefix << \"" << tabinfo.tablename << "_fts using fts5(" << fulltext_columns(tabinfo, "");
+			prefixquery << ", content='\" << prefix << \"" << tabinfo.tablename << "', content_rowid='id');\" << endl;" << endl;
+
+			std::vector<string> triggers = fulltext_triggers(tabinfo, "");
+			std::vector<string> prefixtriggers = fulltext_triggers(tabinfo, "\" << prefix << \"");
+			for (size_t j = 0; j < triggers.size(); j++) {
+				tablesscript.statement(triggers[j]);
+				prefixquery << "\tquery << \"" << prefixtriggers[j] << "\" << endl;" << endl;
+			}
+			add_query_plan_text(fulltext_insert_row(tabinfo, "", ""));
+			add_query_plan_text(fulltext_delete_row(tabinfo, "", ""));
+		}
+	}
+
+	strm << "const char tables_script[] =" << endl;
+	tablesscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "void create_tables(std::ostream& query, const char* prefix) {" << endl;
+	strm << "\tif (prefix == 0 || *prefix == 0) {" << endl;
+	strm << "\t\tquery << tables_script;" << endl;
+	strm << "\t\treturn;" << endl;
+	strm << "\t}" << endl;
+	strm << prefixquery.str();
+	strm << "}" << endl << endl;
+
+	strm << "void create_callbacks(sqlite3* db, void* self) {" << endl;
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!has_notify_callback(tabinfo))
+			continue;
+		strm << "\tsqlite3_create_function(db, \"" << tabinfo.tablename << "_notify_callback\", -1, SQLITE_ANY, self, " << tabinfo.tablename << "_notify_callback, 0, 0);" << endl;
+		if (generate_instrumentation && undo_triggers(tabinfo))
+			strm << "\tsqlite3_create_function(db, \"" << tabinfo.tablename << "_undo_stats\", 2, SQLITE_ANY, 0, " << tabinfo.tablename << "_undo_stats, 0, 0);" << endl;
+	}
+	if (undo_dedup_bytes > 0)
+		strm << "\tcreate_undo_values(db);" << endl;
+	if (generate_bulk_sessions)
+		strm << "\tsqlite3_create_function_v2(db, \"dbgenpp_bulk_session\", -1, SQLITE_ANY, new int(0), dbgenpp_bulk_session, 0, 0, dbgenpp_bulk_session_destroy);" << endl;
+	strm << "}" << endl << endl;
+
+	// temp triggers are recreated on every connection. persistent triggers
+	// are stored in the database and installed once by install_triggers().
+	std::string createtrigger = generate_persistent_triggers ? "create trigger if not exists " : "create temp trigger ";
+	sqlscript triggersscript, dropscript;
+
+	// during bulk sessions the notify and undo triggers are skipped through a
+	// when clause. the delete trigger also runs cascades, so it is guarded
+	// per statement instead.
+	std::string when = generate_bulk_sessions ? " when dbgenpp_bulk_session() = 0" : "";
+	std::string guard = generate_bulk_sessions ? "dbgenpp_bulk_session() = 0 and " : "";
+
+	for (size_t i = 0; i < tables.size(); i++) {
+		tableinfo& tabinfo = tables[i];
+		if (!tabinfo.shardkey.empty())
+			continue;
+		triggersscript.comment(tabinfo.tablename + ":");
+
+		stringstream newfieldsquery, oldfieldsnoquotequery, changedmaskquery, changedfieldsquery;
+		stringstream changedundoquery, changedguard;
+		for (size_t j = 0; j < tabinfo.fields.size(); j++) {
+			fieldinfo& fi = tabinfo.fields[j];
+			if (j > 0) newfieldsquery << ", ";
+			newfieldsquery << "new." << fi.fieldname;
+
+			if (j > 0) oldfieldsnoquotequery << ", ";
+			oldfieldsnoquotequery << "old." << fi.fieldname;
+
+			// with deduplication, update undo queries restore only the
+			// changed columns
+			if (j > 0) changedundoquery << "||";
+			changedundoquery << "case when new." << fi.fieldname << " is not old." << fi.fieldname << " then ', " << fi.fieldname << " = '||" << undo_quote(fi) << " else '' end";
+			if (j > 0) changedguard << " or ";
+			changedguard << "new." << fi.fieldname << " is not old." << fi.fieldname;
+
+			// with changed_columns, update notifications pass a mask of the
+			// changed columns, and null instead of the old value of unchanged
+			// columns
+			if (j > 0) changedmaskquery << " | ";
+			changedmaskquery << "((new." << fi.fieldname << " is not old." << fi.fieldname << ") << " << changed_bit(j) << ")";
+
+			if (j > 0) changedfieldsquery << ", ";
+			changedfieldsquery << "case when new." << fi.fieldname << " is not old." << fi.fieldname << " then old." << fi.fieldname << " end";
+		}
+
+		const char* triggernames[] = { "_before_insert_trigger", "_insert_notify_trigger", "_delete_notify_trigger", "_after_delete_trigger", "_before_update_notify_trigger", "_update_notify_trigger" };
+		for (size_t j = 0; j < sizeof(triggernames) / sizeof(triggernames[0]); j++) {
+			dropscript.statement("drop trigger if exists " + tabinfo.tablename + triggernames[j] + ";");
+		}
+
+		// generate before insert trigger:
+		if (tabinfo.generate_before_insert) {
+			triggersscript.statement(createtrigger + tabinfo.tablename + "_before_insert_trigger before insert on " + tabinfo.tablename + when + " begin");
+			triggersscript.statement("select raise(abort, 'before insert failed from callback constraint') where " + tabinfo.tablename + "_notify_callback(10, " + newfieldsquery.str() + ") = 0;");
+			triggersscript.statement("end;");
+			triggersscript.blank();
+		}
+
+		// generate after insert trigger:
+		if (tabinfo.generate_after_insert || undo_triggers(tabinfo)) {
+			triggersscript.statement(createtrigger + tabinfo.tablename + "_insert_notify_trigger after insert on " + tabinfo.tablename + when + " begin");
+			if (undo_triggers(tabinfo)) {
+				add_undo_statements(triggersscript, tabinfo, undo_insert_query(tabinfo, false), "0", "");
+				add_query_plan_text(undo_insert_query(tabinfo, true));
+			}
+			if (tabinfo.generate_after_insert) {
+				triggersscript.statement("select raise(abort, 'after insert failed from callback constraint') where " + tabinfo.tablename + "_notify_callback(0, " + newfieldsquery.str() + ") = 0;");
+			}
+			triggersscript.statement("end;");
+			triggersscript.blank();
+		}
+
+		// generate before delete trigger:
+		int cascadecount = 0;
+		for (size_t j = 0; j < tables.size(); j++) {
+			tableinfo& otabinfo = tables[j];
+			for (size_t i = 0; i < otabinfo.fields.size(); i++) {	
+				fieldinfo& finfo = otabinfo.fields[i];
+				if (finfo.keytable == tabinfo.tablename && finfo.cascade) {
+					cascadecount ++;
+				}
+			}
+		}
+
+		if (cascadecount > 0 || tabinfo.generate_before_delete || undo_triggers(tabinfo)) {
+			std::string deletewhen = cascadecount > 0 ? "" : when;
+			std::string deleteguard = cascadecount > 0 ? guard : "";
+			triggersscript.statement(createtrigger + tabinfo.tablename + "_delete_notify_trigger before delete on " + tabinfo.tablename + deletewhen + " begin");
 			
 			if (tabinfo.generate_before_delete) {
-				strm << "\tquery << \"select raise(abort, 'before delete failed from callback constraint') where " << tabinfo.tablename << "_notify_callback(11, " << oldfieldsnoquotequery.str() << ") = 0;\" << endl;" << endl;
+				triggersscript.statement("select raise(abort, 'before delete failed from callback constraint') where " + deleteguard + tabinfo.tablename + "_notify_callback(11, " + oldfieldsnoquotequery.str() + ") = 0;");
 			}
 
 			// cascade delete
@@ -285,42 +3613,149 @@ void documentgen::generate_document_implementation(const std::string& prefix, st
 				for (size_t i = 0; i < otabinfo.fields.size(); i++) {	
 					fieldinfo& finfo = otabinfo.fields[i];
 					if (finfo.keytable == tabinfo.tablename && finfo.cascade) {
-						strm << "\tquery << \"delete from " << otabinfo.tablename << " where " << finfo.fieldname << " = old.id;\" << endl;" << endl;
+						std::string cascade = "delete from " + otabinfo.tablename + " where " + finfo.fieldname + " = ";
+						triggersscript.statement(cascade + "old." + finfo.keyname + ";");
+						add_query_plan_text(cascade + "?;");
 					}
 				}
 			}
 
-			if (tabinfo.generate_undo)
-				strm << "\tquery << \"select undoredo_add_query('insert into " << tabinfo.tablename << " values(" << oldfieldsquery.str() << ");') where undoredo_enabled_callback() = 1;\" << endl;" << endl;
-			strm << "\tquery << \"end;\" << endl;" << endl << endl;
+			if (undo_triggers(tabinfo)) {
+				add_undo_statements(triggersscript, tabinfo, undo_delete_query(tabinfo, false), "1", deleteguard);
+				add_query_plan_text(undo_delete_query(tabinfo, true));
+			}
+			triggersscript.statement("end;");
+			triggersscript.blank();
 		}
 
 		// generate after delete trigger:
 		if (tabinfo.generate_after_delete) {
-			strm << "\tquery << \"create temp trigger " << tabinfo.tablename << "_after_delete_trigger after delete on " << tabinfo.tablename << " begin\" << endl;" << endl;
-			strm << "\tquery << \"select raise(abort, 'after delete failed from callback constraint') where " << tabinfo.tablename << "_notify_callback(1, " << oldfieldsnoquotequery.str() << ") = 0;\" << endl;" << endl;
-			strm << "\tquery << \"end;\" << endl;" << endl << endl;
+			triggersscript.statement(createtrigger + tabinfo.tablename + "_after_delete_trigger after delete on " + tabinfo.tablename + when + " begin");
+			triggersscript.statement("select raise(abort, 'after delete failed from callback constraint') where " + tabinfo.tablename + "_notify_callback(1, " + oldfieldsnoquotequery.str() + ") = 0;");
+			triggersscript.statement("end;");
+			triggersscript.blank();
 		}
 
 		// generate before update trigger:
 		if (tabinfo.generate_before_update) {
-			strm << "\tquery << \"create temp trigger " << tabinfo.tablename << "_before_update_notify_trigger before update on " << tabinfo.tablename << " begin\" << endl;" << endl;
-			strm << "\tquery << \"select raise(abort, 'before update failed from callback constraint') where " << tabinfo.tablename << "_notify_callback(12, " << newfieldsquery.str() << ") = 0;\" << endl;" << endl;
-			strm << "\tquery << \"end;\" << endl;" << endl << endl;
+			triggersscript.statement(createtrigger + tabinfo.tablename + "_before_update_notify_trigger before update on " + tabinfo.tablename + when + " begin");
+			triggersscript.statement("select raise(abort, 'before update failed from callback constraint') where " + tabinfo.tablename + "_notify_callback(12, " + newfieldsquery.str() + ") = 0;");
+			triggersscript.statement("end;");
+			triggersscript.blank();
 		}
 
 		// generate after update trigger:
-		if (tabinfo.generate_after_update || tabinfo.generate_undo) {
-			strm << "\tquery << \"create temp trigger " << tabinfo.tablename << "_update_notify_trigger after update on " << tabinfo.tablename << " begin\" << endl;" << endl;
+		if (tabinfo.generate_after_update || undo_triggers(tabinfo)) {
+			triggersscript.statement(createtrigger + tabinfo.tablename + "_update_notify_trigger after update on " + tabinfo.tablename + when + " begin");
 			if (tabinfo.generate_after_update) {
-				strm << "\tquery << \"select raise(abort, 'after update failed from callback constraint') where " << tabinfo.tablename << "_notify_callback(2, " << newfieldsquery.str() << ", " << oldfieldsnoquotequery.str() << ") = 0;\" << endl;" << endl;
+				if (generate_changed_columns)
+					triggersscript.statement("select raise(abort, 'after update failed from callback constraint') where " + tabinfo.tablename + "_notify_callback(3, " + newfieldsquery.str() + ", " + changedmaskquery.str() + ", " + changedfieldsquery.str() + ") = 0;");
+				else
+					triggersscript.statement("select raise(abort, 'after update failed from callback constraint') where " + tabinfo.tablename + "_notify_callback(2, " + newfieldsquery.str() + ", " + oldfieldsnoquotequery.str() + ") = 0;");
 			}
-			if (tabinfo.generate_undo)
-				strm << "\tquery << \"select undoredo_add_query('update " << tabinfo.tablename << " set " << updatefieldsquery.str() << " where id = '||quote(old.id)||';') where undoredo_enabled_callback() = 1;\" << endl;" << endl;
-			strm << "\tquery << \"end;\" << endl;" << endl << endl;
+			// the query restoring only the changed columns is checked in the form
+			// restoring all of them, which has the same where clause
+			string key = tabinfo.fields[primary_key_index(tabinfo)].fieldname;
+			if (undo_triggers(tabinfo) && undo_dedup_bytes > 0)
+				add_undo_statements(triggersscript, tabinfo, "'update " + tabinfo.tablename + " set '||substr(" + changedundoquery.str() + ", 3)||' where " + key + " = '||quote(new." + key + ")||';'", "2", "(" + changedguard.str() + ") and ");
+			else if (undo_triggers(tabinfo))
+				add_undo_statements(triggersscript, tabinfo, undo_update_query(tabinfo, false), "2", "");
+			if (undo_triggers(tabinfo))
+				add_query_plan_text(undo_update_query(tabinfo, true));
+			triggersscript.statement("end;");
+			triggersscript.blank();
 		}
 	}
 
+	strm << "const char triggers_script[] =" << endl;
+	triggersscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "void create_triggers(sqlite3* db, std::ostream& query) {" << endl;
+	strm << "\tquery << triggers_script;" << endl;
 	strm << "}" << endl << endl;
 
+	if (generate_persistent_triggers)
+		generate_install_triggers(triggersscript, dropscript, strm);
+
+	if (generate_bulk_sessions)
+		generate_bulk_session_implementation(strm);
+
+	if (generate_reader_pool)
+		generate_reader_pool_implementation(strm);
+
+	if (has_sharded_tables())
+		generate_shards_implementation(strm);
+
+	if (has_snapshot_tables())
+		generate_snapshot_implementation(strm);
+
+	if (generate_navigation)
+		generate_navigation_implementation(strm);
+
+	if (generate_virtual_tables)
+		generate_virtual_tables_implementation(strm);
+
+	if (generate_session_undo)
+		generate_session_undo_implementation(strm);
+
+	if (generate_upsert)
+		generate_upsert_implementation(strm);
+
+	if (generate_cursors)
+		generate_cursors_implementation(strm);
+
+	if (has_fulltext_tables())
+		generate_fulltext_implementation(strm);
+
+	if (generate_query_plan_check)
+		generate_query_plan_check_implementation(strm);
+}
+
+void documentgen::generate_install_triggers(sqlscript& triggersscript, sqlscript& dropscript, std::ostream& strm) {
+	// the version is a hash of the trigger script, so any change to the
+	// generated triggers causes them to be reinstalled
+	unsigned long long version = fnv1a(triggersscript.text);
+	stringstream versionstr;
+	versionstr << std::hex << version;
+
+	strm << "const char trigger_schema_version[] = \"" << versionstr.str() << "\";" << endl << endl;
+
+	strm << "const char drop_triggers_script[] =" << endl;
+	dropscript.write(strm);
+	strm << ";" << endl << endl;
+
+	strm << "// installs the persistent triggers unless the database already has the" << endl;
+	strm << "// triggers for this version of the schema. create_callbacks() must still" << endl;
+	strm << "// be called on every connection that writes to the database." << endl;
+	strm << "bool install_triggers(sqlite3* db) {" << endl;
+	strm << "\tif (sqlite3_exec(db, \"savepoint install_triggers;\", 0, 0, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl << endl;
+	strm << "\t// from here on every error path rolls back and releases the savepoint" << endl;
+	strm << "\tbool installed = false;" << endl;
+	strm << "\tint result = sqlite3_exec(db, \"create table if not exists dbgenpp_trigger_version (version text not null);\", 0, 0, 0);" << endl;
+	strm << "\tif (result == SQLITE_OK) {" << endl;
+	strm << "\t\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\t\tresult = sqlite3_prepare_v2(db, \"select 1 from dbgenpp_trigger_version where version = '" << versionstr.str() << "';\", -1, &stmt, 0);" << endl;
+	strm << "\t\tif (result == SQLITE_OK) {" << endl;
+	strm << "\t\t\tresult = sqlite3_step(stmt);" << endl;
+	strm << "\t\t\tinstalled = result == SQLITE_ROW;" << endl;
+	strm << "\t\t\tif (result == SQLITE_ROW || result == SQLITE_DONE)" << endl;
+	strm << "\t\t\t\tresult = SQLITE_OK;" << endl;
+	strm << "\t\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\tif (result == SQLITE_OK && !installed) {" << endl;
+	strm << "\t\tresult = sqlite3_exec(db, drop_triggers_script, 0, 0, 0);" << endl;
+	strm << "\t\tif (result == SQLITE_OK)" << endl;
+	strm << "\t\t\tresult = sqlite3_exec(db, triggers_script, 0, 0, 0);" << endl;
+	strm << "\t\tif (result == SQLITE_OK)" << endl;
+	strm << "\t\t\tresult = sqlite3_exec(db, \"delete from dbgenpp_trigger_version; insert into dbgenpp_trigger_version values('" << versionstr.str() << "');\", 0, 0, 0);" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\tif (result == SQLITE_OK)" << endl;
+	strm << "\t\tresult = sqlite3_exec(db, \"release install_triggers;\", 0, 0, 0);" << endl;
+	strm << "\tif (result != SQLITE_OK)" << endl;
+	strm << "\t\tsqlite3_exec(db, \"rollback to install_triggers; release install_triggers;\", 0, 0, 0);" << endl;
+	strm << "\treturn result == SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
 }
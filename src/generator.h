@@ -16,6 +16,7 @@ struct fieldinfo {
 	std::string keyname;  // foreign key field
 	bool cascade; // cascade delete by default
 	bool nullable; // nullable foreign keys
+	bool fulltext; // indexed in the fts5 table <table>_fts
 };
 
 struct tableinfo {
@@ -28,12 +29,99 @@ struct tableinfo {
 	bool generate_before_delete;
 	bool generate_after_delete;
 	bool generate_undo;
+	std::string shardkey; // key field of tables spread over attached shard databases
+	bool generate_snapshot; // export to and read from memory mapped snapshots
 };
 
+// a constant sql script emitted as generated c++ source
+struct sqlscript {
+	std::stringstream literal;
+	std::string text;
+
+	void statement(const std::string& sql);
+	void comment(const std::string& comment);
+	void blank();
+	void write(std::ostream& strm);
+};
+
+unsigned long long fnv1a(const char* data, size_t size);
+unsigned long long fnv1a(const std::string& text);
+std::string column_definitions(tableinfo& tabinfo);
+std::string foreign_key_index_name(tableinfo& tabinfo, fieldinfo& finfo);
+bool has_notify_callback(tableinfo& tabinfo);
+bool has_fulltext(tableinfo& tabinfo);
+std::string fulltext_columns(tableinfo& tabinfo, const std::string& qualifier);
+std::string fulltext_table_definition(tableinfo& tabinfo);
+std::string fulltext_insert_row(tableinfo& tabinfo, const std::string& prefix, const std::string& row);
+std::string fulltext_delete_row(tableinfo& tabinfo, const std::string& prefix, const std::string& row);
+std::vector<std::string> fulltext_triggers(tableinfo& tabinfo, const std::string& prefix);
+std::string drop_fulltext_triggers(tableinfo& tabinfo);
+
 struct documentgen {
 	std::vector<tableinfo> tables;
 	std::vector<tableinfo> events;
+	bool generate_instrumentation; // per-table callback and undo counters
+	bool generate_changed_columns; // after update notifications pass a changed column mask and only changed old values
+	bool generate_persistent_triggers; // install versioned triggers once instead of temp triggers
+	bool generate_bulk_sessions; // begin/end_bulk_session suspending per-row triggers
+	bool generate_reader_pool; // wal writer plus a pool of read-only connections
+	bool generate_navigation; // children_<child>_of_<parent> and parent_of helpers
+	bool generate_virtual_tables; // sqlite modules over vectors of table structs
+	bool generate_session_undo; // undo/redo changesets from the session extension instead of undo triggers
+	bool generate_row_arena; // trigger callback rows in pmr containers drawing from a per-thread arena
+	bool generate_query_plan_check; // verify_query_plans() reporting keyed statements which scan a table
+	bool generate_upsert; // upsert_<table> and update_<table>_columns through statements prepared once
+	bool generate_cursors; // <table>_cursor reading a table in key order one page at a time
+	bool generate_extern_templates; // run time templates instantiated once in <prefix>_instances_cpp.h
+	bool generate_instances_per_table; // one instantiation unit per table, <prefix>_instances_<table>_cpp.h
+	int undo_dedup_bytes; // undo values of at least this size are stored once by content hash, 0 to disable
+	int shard_count; // number of shard databases for tables with a shard key
+	std::vector<std::pair<std::string, std::string> > query_plans; // c++ expressions of the statements checked by verify_query_plans() and the table each reads completely, or 0
 
+	documentgen();
 	void generate_document_header(const std::string& prefix, std::ostream& strm);
 	void generate_document_implementation(const std::string& prefix, std::ostream& strm);
+	void generate_stats_header(std::ostream& strm);
+	void generate_stats_implementation(std::ostream& strm);
+	void generate_install_triggers(sqlscript& triggersscript, sqlscript& dropscript, std::ostream& strm);
+	void generate_bulk_session_header(std::ostream& strm);
+	std::vector<size_t> bulk_snapshot_tables(size_t index);
+	void generate_bulk_session_implementation(std::ostream& strm);
+	void generate_reader_pool_header(std::ostream& strm);
+	void generate_reader_pool_implementation(std::ostream& strm);
+	bool has_sharded_tables();
+	void generate_shards_header(std::ostream& strm);
+	void generate_shards_implementation(std::ostream& strm);
+	bool has_snapshot_tables();
+	void generate_snapshot_header(std::ostream& strm);
+	void generate_snapshot_implementation(std::ostream& strm);
+	void generate_navigation_header(std::ostream& strm);
+	void generate_navigation_implementation(std::ostream& strm);
+	void generate_virtual_tables_header(std::ostream& strm);
+	void generate_virtual_tables_implementation(std::ostream& strm);
+	bool undo_triggers(tableinfo& tabinfo);
+	void generate_session_undo_header(std::ostream& strm);
+	void generate_session_undo_implementation(std::ostream& strm);
+	std::string undo_quote(fieldinfo& finfo);
+	std::string undo_insert_query(tableinfo& tabinfo, bool plan);
+	std::string undo_delete_query(tableinfo& tabinfo, bool plan);
+	std::string undo_update_query(tableinfo& tabinfo, bool plan);
+	void generate_undo_values_header(std::ostream& strm);
+	void generate_undo_values_implementation(std::ostream& strm);
+	void generate_row_arena_implementation(std::ostream& strm);
+	void generate_upsert_header(std::ostream& strm);
+	void generate_upsert_implementation(std::ostream& strm);
+	void generate_cursors_header(std::ostream& strm);
+	void generate_cursors_implementation(std::ostream& strm);
+	bool has_fulltext_tables();
+	void generate_fulltext_header(std::ostream& strm);
+	void generate_fulltext_implementation(std::ostream& strm);
+	void generate_query_plan_check_header(std::ostream& strm);
+	void generate_query_plan_check_implementation(std::ostream& strm);
+	void add_query_plan(const std::string& query, const std::string& scan = "0");
+	void add_query_plan_text(const std::string& sql, const std::string& scan = "");
+	bool uses_notify_template();
+	void generate_extern_template_declarations(const std::string& prefix, std::ostream& strm);
+	void generate_instantiation_unit(const std::string& prefix, tableinfo* tabinfo, std::ostream& strm);
+	void add_undo_statements(sqlscript& script, tableinfo& tabinfo, const std::string& undoquery, const std::string& statsevent, const std::string& guard);
 };
@@ -3,8 +3,22 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#if defined(_WIN32)
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
 #include "parser.h"
 #include "generator.h"
+#include "migration.h"
 
 using std::cout;
 using std::cerr;
@@ -32,21 +46,100 @@ std::string get_basepath(const std::string filename) {
 	return "";
 }
 
-int main(int argc, char* argv[]) {
+// creates the cache directory if it does not exist. its parent must exist.
+bool create_directory(const std::string& path) {
+#if defined(_WIN32)
+	return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+	return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+}
 
-	documentgen gen;
-	documentgenparser parser;
+// lists the names of the files in directory, which is empty or ends with a
+// path separator
+std::vector<std::string> list_directory(const std::string& directory) {
+	std::vector<std::string> result;
+#if defined(_WIN32)
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return result;
+	do {
+		result.push_back(data.cFileName);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR* dir = opendir(directory.empty() ? "." : directory.c_str());
+	if (!dir)
+		return result;
+	while (struct dirent* entry = readdir(dir)) {
+		result.push_back(entry->d_name);
+	}
+	closedir(dir);
+#endif
+	return result;
+}
 
-	if (argc != 2) {
-		cout << "usage: dbgenpp [inputfile]" << endl << endl;
-		return 1;
+// removes the instantiation units of prefix written by an earlier run which
+// are not in keep, such as the units of removed tables or of a run with
+// different "extern_templates" or "instances_per_table" options. only files
+// starting with the header written by generate_instantiation_unit are removed.
+void remove_stale_instance_files(const std::string& basepath, const std::string& prefix, const std::vector<std::string>& keep) {
+	std::string start = prefix + "_instances";
+	std::string end = "_cpp.h";
+	std::string header = "// (automatically generated)\n\n// explicit instantiations of the templates declared extern in " + prefix + "_types";
+	std::vector<std::string> names = list_directory(basepath);
+	for (size_t i = 0; i < names.size(); i++) {
+		std::string filename = basepath + names[i];
+		if (names[i].size() < start.size() + end.size() || names[i].compare(0, start.size(), start) != 0 || names[i].compare(names[i].size() - end.size(), end.size(), end) != 0)
+			continue;
+		if (std::find(keep.begin(), keep.end(), filename) != keep.end())
+			continue;
+		std::ifstream inf(filename.c_str());
+		std::string text(header.size(), '\0');
+		if (!inf.read(&text[0], text.size()) || text != header)
+			continue;
+		inf.close();
+		std::remove(filename.c_str());
 	}
+}
 
-	std::string inputfile = argv[1];
+// opens an output file for writing, reporting a failure to err
+bool open_output(fstream& outf, const std::string& filename, std::ostream& err) {
+	outf.clear();
+	outf.open(filename.c_str(), std::ios::trunc | std::ios::out);
+	if (!outf) {
+		err << "cannot open output file " << filename << endl;
+		return false;
+	}
+	return true;
+}
+
+// closes an output file, reporting a failed write to err
+bool close_output(fstream& outf, const std::string& filename, std::ostream& err) {
+	outf.close();
+	if (!outf) {
+		err << "cannot write output file " << filename << endl;
+		return false;
+	}
+	return true;
+}
+
+struct dbgenjob {
+	std::string inputfile;
+	std::stringstream errors;
+	int result;
+};
+
+int process_file(const std::string& inputfile, const std::string& cachedir, std::ostream& err) {
+
+	documentgen gen;
+	documentgenparser parser(err);
+	parser.cachedir = cachedir;
 
 	std::string prefix = get_basename(inputfile);
 	if (prefix.empty()) {
-		cerr << "unable to determine short name from input file name" << endl;
+		err << "unable to determine short name from input file name" << endl;
 		return 3;
 	}
 
@@ -60,13 +153,196 @@ int main(int argc, char* argv[]) {
 	std::string outputimplfile = basepath + prefix + "_types_cpp.h";
 
 	fstream outf;
-	outf.open(outputimplfile.c_str(), std::ios::trunc | std::ios::out);
+	if (!open_output(outf, outputimplfile, err))
+		return 4;
 	gen.generate_document_implementation(prefix, outf);
-	outf.close();
+	if (!close_output(outf, outputimplfile, err))
+		return 4;
 
-	outf.open(outputheaderfile.c_str(), std::ios::trunc | std::ios::out);
+	if (!open_output(outf, outputheaderfile, err))
+		return 4;
 	gen.generate_document_header(prefix, outf);
-	outf.close();
+	if (!close_output(outf, outputheaderfile, err))
+		return 4;
+
+	std::vector<std::string> instancesfiles;
+	if (gen.generate_extern_templates) {
+		if (gen.generate_instances_per_table) {
+			for (size_t i = 0; i < gen.tables.size(); i++) {
+				if (!has_notify_callback(gen.tables[i]))
+					continue;
+				std::string outputinstancesfile = basepath + prefix + "_instances_" + gen.tables[i].tablename + "_cpp.h";
+				if (!open_output(outf, outputinstancesfile, err))
+					return 4;
+				gen.generate_instantiation_unit(prefix, &gen.tables[i], outf);
+				if (!close_output(outf, outputinstancesfile, err))
+					return 4;
+				instancesfiles.push_back(outputinstancesfile);
+			}
+		} else {
+			std::string outputinstancesfile = basepath + prefix + "_instances_cpp.h";
+			if (!open_output(outf, outputinstancesfile, err))
+				return 4;
+			gen.generate_instantiation_unit(prefix, 0, outf);
+			if (!close_output(outf, outputinstancesfile, err))
+				return 4;
+			instancesfiles.push_back(outputinstancesfile);
+		}
+	}
+	remove_stale_instance_files(basepath, prefix, instancesfiles);
+
+	return 0;
+}
+
+// generates <prefix>_migration_cpp.h next to the new input file, migrating
+// databases created from oldfile to the schema in newfile
+int process_migration(const std::string& oldfile, const std::string& newfile, const std::string& cachedir, std::ostream& err) {
+
+	documentgen oldgen, newgen;
+	documentgenparser oldparser(err), newparser(err);
+	oldparser.cachedir = cachedir;
+	newparser.cachedir = cachedir;
+
+	std::string prefix = get_basename(newfile);
+	if (prefix.empty()) {
+		err << "unable to determine short name from input file name" << endl;
+		return 3;
+	}
+
+	if (!oldparser.parse_dbgen(oldfile.c_str(), &oldgen) || !newparser.parse_dbgen(newfile.c_str(), &newgen)) {
+		return 2;
+	}
+
+	migrationgen migration;
+	if (!migration.diff(oldgen, newgen, err)) {
+		return 2;
+	}
+
+	std::string outputfile = get_basepath(newfile) + prefix + "_migration_cpp.h";
+
+	fstream outf;
+	if (!open_output(outf, outputfile, err))
+		return 4;
+	migration.generate_migration(prefix, outf);
+	if (!close_output(outf, outputfile, err))
+		return 4;
 
 	return 0;
 }
+
+// reads input file names from a response file, one per line. blank lines
+// and lines starting with # are ignored.
+bool read_response_file(const std::string& filename, std::vector<std::string>& result) {
+	std::ifstream strm(filename.c_str());
+	if (!strm) {
+		cerr << "cannot open response file " << filename << endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(strm, line)) {
+		std::string::size_type first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#') continue;
+		std::string::size_type last = line.find_last_not_of(" \t\r");
+		result.push_back(line.substr(first, last - first + 1));
+	}
+	return true;
+}
+
+void print_errors(dbgenjob& job) {
+	std::string line;
+	while (std::getline(job.errors, line)) {
+		cerr << job.inputfile << ": " << line << endl;
+	}
+}
+
+int main(int argc, char* argv[]) {
+
+	std::string cachedir;
+	int firstarg = 1;
+	if (argc > 2 && std::string(argv[1]) == "--cache-dir") {
+		cachedir = argv[2];
+		firstarg = 3;
+	}
+
+	if (argc <= firstarg) {
+		cout << "usage: dbgenpp [--cache-dir dir] [inputfile ...] [@responsefile]" << endl;
+		cout << "       dbgenpp [--cache-dir dir] --migrate oldfile newfile" << endl << endl;
+		return 1;
+	}
+
+	if (!cachedir.empty() && !create_directory(cachedir)) {
+		cerr << "cannot create cache directory " << cachedir << endl;
+		return 1;
+	}
+
+	if (std::string(argv[firstarg]) == "--migrate") {
+		if (argc != firstarg + 3) {
+			cout << "usage: dbgenpp [--cache-dir dir] --migrate oldfile newfile" << endl << endl;
+			return 1;
+		}
+		return process_migration(argv[firstarg + 1], argv[firstarg + 2], cachedir, cerr);
+	}
+
+	std::vector<std::string> inputfiles;
+	for (int i = firstarg; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.size() > 1 && arg[0] == '@') {
+			if (!read_response_file(arg.substr(1), inputfiles))
+				return 1;
+		} else {
+			inputfiles.push_back(arg);
+		}
+	}
+
+	std::vector<dbgenjob> jobs(inputfiles.size());
+	for (size_t i = 0; i < jobs.size(); i++) {
+		jobs[i].inputfile = inputfiles[i];
+		jobs[i].result = 0;
+	}
+
+	// each input file is an independent job. workers pick the next unclaimed
+	// job and report its errors as a block, prefixed with the file name.
+	std::atomic<size_t> nextjob(0);
+	std::mutex outputlock;
+	auto worker = [&]() {
+		for (;;) {
+			size_t index = nextjob++;
+			if (index >= jobs.size()) break;
+
+			dbgenjob& job = jobs[index];
+			job.result = process_file(job.inputfile, cachedir, job.errors);
+
+			std::lock_guard<std::mutex> lock(outputlock);
+			print_errors(job);
+		}
+	};
+
+	size_t threadcount = std::thread::hardware_concurrency();
+	if (threadcount == 0) threadcount = 1;
+	if (threadcount > jobs.size()) threadcount = jobs.size();
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadcount; i++) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	int result = 0;
+	size_t failed = 0;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (jobs[i].result != 0) {
+			if (result == 0) result = jobs[i].result;
+			failed++;
+		}
+	}
+
+	if (jobs.size() > 1 && failed > 0) {
+		cerr << failed << " of " << jobs.size() << " input files failed" << endl;
+	}
+
+	return result;
+}
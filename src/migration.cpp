@@ -0,0 +1,363 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "generator.h"
+#include "migration.h"
+
+using std::endl;
+using std::string;
+using std::stringstream;
+
+tableinfo* find_table(std::vector<tableinfo>& tables, const string& name) {
+	for (size_t i = 0; i < tables.size(); i++) {
+		if (tables[i].tablename == name) return &tables[i];
+	}
+	return 0;
+}
+
+// varchar sizes are not enforced by sqlite, so they do not need a migration
+bool same_column(fieldinfo& a, fieldinfo& b) {
+	return a.fieldname == b.fieldname && a.type == b.type && a.primarykey == b.primarykey && a.keytable == b.keytable && a.keyname == b.keyname;
+}
+
+// returns true if to only appends columns to from which can be added with
+// alter table. columns are appended in place, since undo queries insert rows
+// by column position.
+bool can_add_columns(tableinfo& from, tableinfo& to) {
+	if (to.fields.size() < from.fields.size()) return false;
+	for (size_t i = 0; i < from.fields.size(); i++) {
+		if (!same_column(from.fields[i], to.fields[i])) return false;
+	}
+	for (size_t i = from.fields.size(); i < to.fields.size(); i++) {
+		if (to.fields[i].primarykey) return false;
+	}
+	return true;
+}
+
+string column_definition(fieldinfo& finfo) {
+	tableinfo column;
+	column.fields.push_back(finfo);
+	return column_definitions(column);
+}
+
+string create_indexes(tableinfo& tabinfo, size_t firstfield) {
+	string result;
+	for (size_t i = firstfield; i < tabinfo.fields.size(); i++) {
+		fieldinfo& finfo = tabinfo.fields[i];
+		if (finfo.keytable.empty()) continue;
+		result += "create index " + foreign_key_index_name(tabinfo, finfo) + " ON " + tabinfo.tablename + "(" + finfo.fieldname + ");\n";
+	}
+	return result;
+}
+
+void add_script_step(std::vector<migrationstep>& steps, const string& description, const string& script) {
+	migrationstep step;
+	step.kind = migration_script;
+	step.description = description;
+	step.script = script;
+	steps.push_back(step);
+}
+
+// rebuilds a table by copying the columns it shares with the new version
+// into a new table, which replaces the old table once all rows are copied.
+// triggers on the old table apply writes made while the copy is in progress
+// to the new table, and the copy skips rows the triggers already wrote. rows
+// are matched by the integer primary key when both versions share it, and
+// otherwise by rowid, which is then copied too.
+void add_rebuild_steps(std::vector<migrationstep>& steps, tableinfo& from, tableinfo& to) {
+	string newtable = "dbgenpp_migration_" + to.tablename;
+	string columns, newvalues;
+	string key = "rowid";
+	for (size_t i = 0; i < to.fields.size(); i++) {
+		for (size_t j = 0; j < from.fields.size(); j++) {
+			if (from.fields[j].fieldname != to.fields[i].fieldname) continue;
+			if (!columns.empty()) columns += ", ";
+			columns += to.fields[i].fieldname;
+			if (!newvalues.empty()) newvalues += ", ";
+			newvalues += "new." + to.fields[i].fieldname;
+			if (to.fields[i].primarykey && to.fields[i].type == dbgen_integer && from.fields[j].primarykey)
+				key = to.fields[i].fieldname;
+		}
+	}
+	if (key == "rowid") {
+		columns = columns.empty() ? "rowid" : "rowid, " + columns;
+		newvalues = newvalues.empty() ? "new.rowid" : "new.rowid, " + newvalues;
+	}
+
+	string trigger = "dbgenpp_migration_" + to.tablename;
+	string script = "drop table if exists " + newtable + ";\n";
+	script += "create table " + newtable + " (" + column_definitions(to) + ");\n";
+	script += "drop trigger if exists " + trigger + "_insert;\n";
+	script += "drop trigger if exists " + trigger + "_update;\n";
+	script += "drop trigger if exists " + trigger + "_delete;\n";
+	script += "create trigger " + trigger + "_insert after insert on " + from.tablename + " begin insert into " + newtable + " (" + columns + ") values (" + newvalues + "); end;\n";
+	script += "create trigger " + trigger + "_update after update on " + from.tablename + " begin delete from " + newtable + " where " + key + " = old." + key + "; insert into " + newtable + " (" + columns + ") values (" + newvalues + "); end;\n";
+	script += "create trigger " + trigger + "_delete after delete on " + from.tablename + " begin delete from " + newtable + " where " + key + " = old." + key + "; end;\n";
+	add_script_step(steps, "create " + newtable, script);
+
+	migrationstep copy;
+	copy.kind = migration_copy;
+	copy.description = "copy " + to.tablename;
+	copy.script = "insert into " + newtable + " (" + columns + ") select " + columns + " from " + from.tablename + " where rowid > ?1 and rowid <= ?2 and not exists (select 1 from " + newtable + " where " + newtable + "." + key + " = " + from.tablename + "." + key + ");";
+	copy.bound = "select max(rowid) from (select rowid from " + from.tablename + " where rowid > ?1 order by rowid limit ?2);";
+	steps.push_back(copy);
+
+	// dropping the old table also drops the triggers filling the new one
+	add_script_step(steps, "replace " + to.tablename, "drop table " + from.tablename + ";\nalter table " + newtable + " rename to " + to.tablename + ";\n" + create_indexes(to, 0));
+}
+
+bool migrationgen::diff(documentgen& from, documentgen& to, std::ostream& err) {
+	steps.clear();
+	for (size_t i = 0; i < to.tables.size(); i++) {
+		tableinfo& totable = to.tables[i];
+		tableinfo* fromtable = find_table(from.tables, totable.tablename);
+		if (!totable.shardkey.empty() || (fromtable && !fromtable->shardkey.empty())) {
+			err << "sharded table " << totable.tablename << " is not migrated" << endl;
+			continue;
+		}
+
+		string fromcolumns = fromtable ? fulltext_columns(*fromtable, "") : "";
+		string tocolumns = fulltext_columns(totable, "");
+		string fulltexttriggers;
+		if (!tocolumns.empty()) {
+			std::vector<string> triggers = fulltext_triggers(totable, "");
+			for (size_t j = 0; j < triggers.size(); j++) {
+				fulltexttriggers += triggers[j] + "\n";
+			}
+		}
+
+		if (!fromtable) {
+			add_script_step(steps, "create " + totable.tablename, "create table " + totable.tablename + " (" + column_definitions(totable) + ");\n" + create_indexes(totable, 0));
+		} else if (can_add_columns(*fromtable, totable)) {
+			string script;
+			for (size_t j = fromtable->fields.size(); j < totable.fields.size(); j++) {
+				script += "alter table " + totable.tablename + " add column " + column_definition(totable.fields[j]) + ";\n";
+			}
+			if (!script.empty())
+				add_script_step(steps, "alter " + totable.tablename, script + create_indexes(totable, fromtable->fields.size()));
+		} else {
+			add_rebuild_steps(steps, *fromtable, totable);
+			// dropping the old table dropped its fts5 sync triggers, so they
+			// are created again in the same step
+			if (fromcolumns == tocolumns)
+				steps.back().script += fulltexttriggers;
+		}
+
+		// the fts5 index and its sync triggers are recreated and the index
+		// filled from the table when its columns change
+		if (fromcolumns != tocolumns) {
+			string fts = totable.tablename + "_fts";
+			string script = drop_fulltext_triggers(totable) + "drop table if exists " + fts + ";\n";
+			if (!tocolumns.empty())
+				script += fulltext_table_definition(totable) + "\ninsert into " + fts + "(" + fts + ") values ('rebuild');\n" + fulltexttriggers;
+			add_script_step(steps, "index " + totable.tablename, script);
+		}
+	}
+
+	for (size_t i = from.tables.size(); i-- > 0; ) {
+		tableinfo& fromtable = from.tables[i];
+		if (!find_table(to.tables, fromtable.tablename) && fromtable.shardkey.empty())
+			add_script_step(steps, "drop " + fromtable.tablename, (has_fulltext(fromtable) ? "drop table " + fromtable.tablename + "_fts;\n" : "") + "drop table " + fromtable.tablename + ";\n");
+	}
+	return true;
+}
+
+void migrationgen::generate_migration(const std::string& prefix, std::ostream& strm) {
+	string versiontext;
+	for (size_t i = 0; i < steps.size(); i++) {
+		versiontext += steps[i].script + steps[i].bound;
+	}
+	stringstream version;
+	version << std::hex << fnv1a(versiontext);
+
+	strm << "// (automatically generated)" << endl << endl;
+	strm << "// migrates a database to the schema of " << prefix << ". every step commits" << endl;
+	strm << "// on its own, and copy steps commit once per chunk of rows. the progress" << endl;
+	strm << "// is kept in dbgenpp_migration, so an interrupted migration continues" << endl;
+	strm << "// where it stopped when migrate() is called again." << endl << endl;
+
+	strm << "#include <string>" << endl << endl;
+
+	strm << "namespace " << prefix << "_migration {" << endl << endl;
+
+	strm << "enum { script_step, copy_step };" << endl << endl;
+
+	strm << "struct migration_step {" << endl;
+	strm << "\tint kind;" << endl;
+	strm << "\tconst char* description;" << endl;
+	strm << "\tconst char* script;" << endl;
+	strm << "\tconst char* bound;" << endl;
+	strm << "};" << endl << endl;
+
+	strm << "const char version[] = \"" << version.str() << "\";" << endl << endl;
+
+	strm << "const migration_step steps[] = {" << endl;
+	for (size_t i = 0; i < steps.size(); i++) {
+		migrationstep& step = steps[i];
+		strm << "\t{ " << (step.kind == migration_script ? "script_step" : "copy_step") << ", \"" << step.description << "\"," << endl;
+		sqlscript script;
+		stringstream lines(step.script);
+		string line;
+		while (std::getline(lines, line)) {
+			script.statement(line);
+		}
+		script.write(strm);
+		strm << "\t\t, " << (step.bound.empty() ? "0" : "\"" + step.bound + "\"") << " }," << endl;
+	}
+	if (steps.empty())
+		strm << "\t{ script_step, \"no changes\", \"\", 0 }," << endl;
+	strm << "};" << endl << endl;
+
+	strm << "const int step_count = sizeof(steps) / sizeof(steps[0]);" << endl;
+	strm << "const sqlite3_int64 first_rowid = -9223372036854775807LL - 1;" << endl << endl;
+
+	strm << "// called after every step and every copied chunk" << endl;
+	strm << "typedef void (*migration_progress)(void* user, int step, int steps, const char* description, long long rows);" << endl << endl;
+
+	strm << "bool exec(sqlite3* db, const char* query) {" << endl;
+	strm << "\treturn sqlite3_exec(db, query, 0, 0, 0) == SQLITE_OK;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool save_progress(sqlite3* db, int step, sqlite3_int64 last) {" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"update dbgenpp_migration set step = ?2, last = ?3 where version = ?1;\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_bind_text(stmt, 1, version, -1, SQLITE_STATIC);" << endl;
+	strm << "\tsqlite3_bind_int(stmt, 2, step);" << endl;
+	strm << "\tsqlite3_bind_int64(stmt, 3, last);" << endl;
+	strm << "\tbool result = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// an interrupted migration to another version leaves its progress, its new" << endl;
+	strm << "// tables and the triggers filling them behind, which are dropped" << endl;
+	strm << "bool drop_stale_progress(sqlite3* db) {" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"select type, name from sqlite_master where type in ('table', 'trigger') and name like 'dbgenpp\\\\_migration\\\\_%' escape '\\\\' order by type = 'table';\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tstd::string script;" << endl;
+	strm << "\twhile (sqlite3_step(stmt) == SQLITE_ROW) {" << endl;
+	strm << "\t\tscript += std::string(\"drop \") + (const char*)sqlite3_column_text(stmt, 0) + \" if exists \\\"\" + (const char*)sqlite3_column_text(stmt, 1) + \"\\\";\";" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"delete from dbgenpp_migration where version <> ?1;\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_bind_text(stmt, 1, version, -1, SQLITE_STATIC);" << endl;
+	strm << "\tbool result = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\treturn result && exec(db, script.c_str());" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "bool load_progress(sqlite3* db, int& step, sqlite3_int64& last) {" << endl;
+	strm << "\tif (!exec(db, \"create table if not exists dbgenpp_migration (version text primary key, step integer not null, last integer not null);\"))" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"select count(*) from dbgenpp_migration where version <> ?1;\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_bind_text(stmt, 1, version, -1, SQLITE_STATIC);" << endl;
+	strm << "\tbool stale = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\tif (stale && !(exec(db, \"begin;\") && drop_stale_progress(db) && exec(db, \"commit;\"))) {" << endl;
+	strm << "\t\texec(db, \"rollback;\");" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"insert or ignore into dbgenpp_migration values (?1, 0, ?2);\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_bind_text(stmt, 1, version, -1, SQLITE_STATIC);" << endl;
+	strm << "\tsqlite3_bind_int64(stmt, 2, first_rowid);" << endl;
+	strm << "\tbool result = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\tif (!result || sqlite3_prepare_v2(db, \"select step, last from dbgenpp_migration where version = ?1;\", -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_bind_text(stmt, 1, version, -1, SQLITE_STATIC);" << endl;
+	strm << "\tresult = sqlite3_step(stmt) == SQLITE_ROW;" << endl;
+	strm << "\tif (result) {" << endl;
+	strm << "\t\tstep = sqlite3_column_int(stmt, 0);" << endl;
+	strm << "\t\tlast = sqlite3_column_int64(stmt, 1);" << endl;
+	strm << "\t}" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// copies the next chunk of at most chunkrows rows. done is set when there" << endl;
+	strm << "// are no rows left." << endl;
+	strm << "bool copy_chunk(sqlite3* db, const migration_step& step, int chunkrows, sqlite3_int64& last, long long& rows, bool& done) {" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, step.bound, -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_bind_int64(stmt, 1, last);" << endl;
+	strm << "\tsqlite3_bind_int(stmt, 2, chunkrows);" << endl;
+	strm << "\tbool result = sqlite3_step(stmt) == SQLITE_ROW;" << endl;
+	strm << "\tdone = sqlite3_column_type(stmt, 0) == SQLITE_NULL;" << endl;
+	strm << "\tsqlite3_int64 bound = sqlite3_column_int64(stmt, 0);" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\tif (!result || done)" << endl;
+	strm << "\t\treturn result;" << endl << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, step.script, -1, &stmt, 0) != SQLITE_OK)" << endl;
+	strm << "\t\treturn false;" << endl;
+	strm << "\tsqlite3_bind_int64(stmt, 1, last);" << endl;
+	strm << "\tsqlite3_bind_int64(stmt, 2, bound);" << endl;
+	strm << "\tresult = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\tsqlite3_finalize(stmt);" << endl;
+	strm << "\trows += sqlite3_changes(db);" << endl;
+	strm << "\tlast = bound;" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "// foreign keys are disabled while tables are replaced. triggers on rebuilt" << endl;
+	strm << "// tables are dropped with them and must be created again afterwards. if" << endl;
+	strm << "// foreign keys were enabled, they are checked once all steps are done, and" << endl;
+	strm << "// on violations migrate() fails and keeps its progress until they are fixed." << endl;
+	strm << "bool migrate(sqlite3* db, int chunkrows, migration_progress progress, void* user) {" << endl;
+	strm << "\tint step = 0;" << endl;
+	strm << "\tsqlite3_int64 last = first_rowid;" << endl;
+	strm << "\tif (!load_progress(db, step, last))" << endl;
+	strm << "\t\treturn false;" << endl << endl;
+	strm << "\tbool foreignkeys = false;" << endl;
+	strm << "\tsqlite3_stmt* stmt = 0;" << endl;
+	strm << "\tif (sqlite3_prepare_v2(db, \"pragma foreign_keys;\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+	strm << "\t\tforeignkeys = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 1;" << endl;
+	strm << "\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t}" << endl;
+	strm << "\texec(db, \"pragma foreign_keys = off;\");" << endl << endl;
+	strm << "\tbool result = true;" << endl;
+	strm << "\tlong long rows = 0;" << endl;
+	strm << "\twhile (result && step < step_count) {" << endl;
+	strm << "\t\tconst migration_step& current = steps[step];" << endl;
+	strm << "\t\tbool done = true;" << endl;
+	strm << "\t\tresult = exec(db, \"begin;\");" << endl;
+	strm << "\t\tif (current.kind == script_step)" << endl;
+	strm << "\t\t\tresult = result && exec(db, current.script);" << endl;
+	strm << "\t\telse" << endl;
+	strm << "\t\t\tresult = result && copy_chunk(db, current, chunkrows, last, rows, done);" << endl;
+	strm << "\t\tif (result && done) {" << endl;
+	strm << "\t\t\tstep++;" << endl;
+	strm << "\t\t\tlast = first_rowid;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t\tresult = result && save_progress(db, step, last) && exec(db, \"commit;\");" << endl;
+	strm << "\t\tif (!result) {" << endl;
+	strm << "\t\t\texec(db, \"rollback;\");" << endl;
+	strm << "\t\t\tbreak;" << endl;
+	strm << "\t\t}" << endl;
+	strm << "\t\tif (progress)" << endl;
+	strm << "\t\t\tprogress(user, done ? step : step + 1, step_count, current.description, rows);" << endl;
+	strm << "\t\tif (done)" << endl;
+	strm << "\t\t\trows = 0;" << endl;
+	strm << "\t}" << endl << endl;
+	strm << "\tif (foreignkeys) {" << endl;
+	strm << "\t\texec(db, \"pragma foreign_keys = on;\");" << endl;
+	strm << "\t\tif (result && sqlite3_prepare_v2(db, \"pragma foreign_key_check;\", -1, &stmt, 0) == SQLITE_OK) {" << endl;
+	strm << "\t\t\tresult = sqlite3_step(stmt) == SQLITE_DONE;" << endl;
+	strm << "\t\t\tsqlite3_finalize(stmt);" << endl;
+	strm << "\t\t} else" << endl;
+	strm << "\t\t\tresult = false;" << endl;
+	strm << "\t}" << endl;
+	strm << "\tif (result)" << endl;
+	strm << "\t\tresult = exec(db, \"drop table dbgenpp_migration;\");" << endl;
+	strm << "\treturn result;" << endl;
+	strm << "}" << endl << endl;
+
+	strm << "}" << endl;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+struct documentgen;
+
+enum migrationstepkind {
+	migration_script, // executed in one transaction
+	migration_copy    // rows copied in rowid ranges, one transaction per chunk
+};
+
+struct migrationstep {
+	migrationstepkind kind;
+	std::string description;
+	std::string script; // script, or the chunk insert for copy steps
+	std::string bound;  // copy steps: the upper rowid of the next chunk
+};
+
+// compares two parsed documents and generates code migrating a database
+// created by the first to the second
+struct migrationgen {
+	std::vector<migrationstep> steps;
+
+	bool diff(documentgen& from, documentgen& to, std::ostream& err);
+	void generate_migration(const std::string& prefix, std::ostream& strm);
+};
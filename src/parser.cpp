@@ -4,37 +4,438 @@
 #include <string>
 #include <vector>
 #include <deque>
-#include "picojson.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#if defined(_WIN32)
+#include <windows.h>
+#include <sys/utime.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
 #include "parser.h"
 #include "generator.h"
 
-using std::cerr;
 using std::endl;
 using std::string;
 
-std::string read_file(std::string const& path) {
-	FILE* file = fopen(path.c_str(), "rb");
+// a read-only view of an input file. the file is mapped instead of read,
+// and the parser works on the mapped bytes in place.
+struct mappedfile {
+	const char* data;
+	size_t size;
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
 
-	if (!file)
-		return "";
+	mappedfile();
+	~mappedfile();
+	bool open(const char* filename);
+};
 
-	fseek(file, 0, SEEK_END);
-	long size = ftell(file);
-	fseek(file, 0, SEEK_SET);
+#if defined(_WIN32)
 
-	std::string text;
-	char* buffer = new char[size + 1];
-	buffer[size] = 0;
+mappedfile::mappedfile() : data(""), size(0), file(INVALID_HANDLE_VALUE), mapping(0) {
+}
+
+mappedfile::~mappedfile() {
+	if (size > 0) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+}
+
+bool mappedfile::open(const char* filename) {
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER filesize;
+	if (!GetFileSizeEx(file, &filesize)) return false;
+	if (filesize.QuadPart == 0) return true;
+	mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mapping) return false;
+	const char* view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) return false;
+	data = view;
+	size = (size_t)filesize.QuadPart;
+	return true;
+}
 
-	if (fread(buffer, 1, size, file) == (unsigned long)size)
-		text = buffer;
+#else
 
-	fclose(file);
-	delete[] buffer;
+mappedfile::mappedfile() : data(""), size(0), fd(-1) {
+}
 
-	return text;
+mappedfile::~mappedfile() {
+	if (size > 0) munmap((void*)data, size);
+	if (fd != -1) close(fd);
+}
+
+bool mappedfile::open(const char* filename) {
+	fd = ::open(filename, O_RDONLY);
+	if (fd == -1) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+	if (st.st_size == 0) return true;
+	void* view = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) return false;
+	data = (const char*)view;
+	size = (size_t)st.st_size;
+	return true;
 }
 
+#endif
+
+// a string token. it points into the input when the string has no escapes,
+// otherwise into the reader's scratch buffer until the next string is read.
+struct jsontext {
+	const char* data;
+	size_t size;
+
+	bool operator==(const char* text) const {
+		return strlen(text) == size && memcmp(data, text, size) == 0;
+	}
+
+	std::string str() const {
+		return std::string(data, size);
+	}
+};
+
+struct jsonlocation {
+	int line;
+	int column;
+};
+
+// a pull parser over json text. values are read as the schema expects them
+// and everything else is skipped without being stored. errors are reported
+// with the line and column of the offending value.
+struct jsonreader {
+	const char* pos;
+	const char* end;
+	const char* linestart;
+	int line;
+	int depth;
+	std::string scratch;
+	std::string source; // prefixed to errors in imported files
+	std::ostream& err;
+
+	jsonreader(const char* data, size_t size, std::ostream& errstrm);
+
+	jsonlocation here();
+	bool error(const jsonlocation& location, const std::string& message);
+	bool error(const std::string& message);
+	char peek();
+	bool expect(char c, const char* what);
+	bool literal(const char* text);
+	bool next_key(bool& first, jsontext& key, bool& done);
+	bool next_element(bool& first, bool& done);
+	bool read_string(jsontext& result);
+	bool read_number(double& result);
+	bool skip_value();
+	bool read_bool(bool& result);
+	bool read_int(int& result);
+	bool read_string_value(std::string& result);
+};
+
+jsonreader::jsonreader(const char* data, size_t size, std::ostream& errstrm)
+	: pos(data), end(data + size), linestart(data), line(1), depth(0), err(errstrm)
+{
+	if (size >= 3 && memcmp(data, "\xef\xbb\xbf", 3) == 0)
+		pos += 3;
+}
+
+jsonlocation jsonreader::here() {
+	peek();
+	jsonlocation location;
+	location.line = line;
+	location.column = (int)(pos - linestart) + 1;
+	return location;
+}
+
+bool jsonreader::error(const jsonlocation& location, const std::string& message) {
+	if (!source.empty())
+		err << source << ": ";
+	err << "line " << location.line << ", column " << location.column << ": " << message << endl;
+	return false;
+}
+
+bool jsonreader::error(const std::string& message) {
+	return error(here(), message);
+}
+
+// skips whitespace and returns the next character, or 0 at the end
+char jsonreader::peek() {
+	while (pos < end) {
+		char c = *pos;
+		if (c == '\n') {
+			line++;
+			linestart = pos + 1;
+		} else if (c != ' ' && c != '\t' && c != '\r') {
+			return c;
+		}
+		pos++;
+	}
+	return 0;
+}
+
+bool jsonreader::expect(char c, const char* what) {
+	if (peek() != c)
+		return error(pos < end ? string("expected ") + what : "unexpected end of file");
+	pos++;
+	return true;
+}
+
+bool jsonreader::literal(const char* text) {
+	size_t length = strlen(text);
+	if ((size_t)(end - pos) < length || memcmp(pos, text, length) != 0)
+		return error("invalid value");
+	pos += length;
+	return true;
+}
+
+// reads the next key of an object whose opening brace has been read. done
+// is set at the closing brace.
+bool jsonreader::next_key(bool& first, jsontext& key, bool& done) {
+	done = false;
+	if (peek() == '}') {
+		pos++;
+		done = true;
+		return true;
+	}
+	if (!first && !expect(',', "',' or '}'"))
+		return false;
+	first = false;
+	if (peek() != '"')
+		return error(pos < end ? "expected a string key" : "unexpected end of file");
+	return read_string(key) && expect(':', "':'");
+}
+
+// positions at the next element of an array whose opening bracket has been
+// read. done is set at the closing bracket.
+bool jsonreader::next_element(bool& first, bool& done) {
+	done = false;
+	if (peek() == ']') {
+		pos++;
+		done = true;
+		return true;
+	}
+	if (!first && !expect(',', "',' or ']'"))
+		return false;
+	first = false;
+	char c = peek();
+	if (c == 0)
+		return error("unexpected end of file");
+	if (c == ']')
+		return error("expected a value");
+	return true;
+}
+
+void append_utf8(std::string& result, unsigned int code) {
+	if (code < 0x80) {
+		result += (char)code;
+	} else if (code < 0x800) {
+		result += (char)(0xc0 | (code >> 6));
+		result += (char)(0x80 | (code & 0x3f));
+	} else if (code < 0x10000) {
+		result += (char)(0xe0 | (code >> 12));
+		result += (char)(0x80 | ((code >> 6) & 0x3f));
+		result += (char)(0x80 | (code & 0x3f));
+	} else {
+		result += (char)(0xf0 | (code >> 18));
+		result += (char)(0x80 | ((code >> 12) & 0x3f));
+		result += (char)(0x80 | ((code >> 6) & 0x3f));
+		result += (char)(0x80 | (code & 0x3f));
+	}
+}
+
+bool read_hex4(const char* text, unsigned int& result) {
+	result = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = text[i];
+		result <<= 4;
+		if (c >= '0' && c <= '9') result |= c - '0';
+		else if (c >= 'a' && c <= 'f') result |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') result |= c - 'A' + 10;
+		else return false;
+	}
+	return true;
+}
+
+bool jsonreader::read_string(jsontext& result) {
+	if (!expect('"', "a string"))
+		return false;
+	const char* begin = pos;
+	while (pos < end && *pos != '"' && *pos != '\\' && (unsigned char)*pos >= 0x20) pos++;
+	if (pos < end && *pos == '"') {
+		result.data = begin;
+		result.size = pos - begin;
+		pos++;
+		return true;
+	}
+
+	// the string has escapes and is decoded into the scratch buffer
+	scratch.assign(begin, pos);
+	while (pos < end && *pos != '"') {
+		char c = *pos;
+		if ((unsigned char)c < 0x20)
+			return error("control character in string");
+		if (c != '\\') {
+			scratch += c;
+			pos++;
+			continue;
+		}
+		if (end - pos < 2)
+			break;
+		char escape = pos[1];
+		pos += 2;
+		switch (escape) {
+			case '"': scratch += '"'; break;
+			case '\\': scratch += '\\'; break;
+			case '/': scratch += '/'; break;
+			case 'b': scratch += '\b'; break;
+			case 'f': scratch += '\f'; break;
+			case 'n': scratch += '\n'; break;
+			case 'r': scratch += '\r'; break;
+			case 't': scratch += '\t'; break;
+			case 'u': {
+				unsigned int code, low;
+				if (end - pos < 4 || !read_hex4(pos, code))
+					return error("invalid unicode escape");
+				pos += 4;
+				if (code >= 0xd800 && code < 0xdc00) {
+					if (end - pos < 6 || pos[0] != '\\' || pos[1] != 'u' || !read_hex4(pos + 2, low) || low < 0xdc00 || low >= 0xe000)
+						return error("invalid unicode surrogate pair");
+					pos += 6;
+					code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+				}
+				append_utf8(scratch, code);
+				break;
+			}
+			default:
+				pos -= 2;
+				return error("invalid escape in string");
+		}
+	}
+	if (pos >= end)
+		return error("unterminated string");
+	pos++;
+	result.data = scratch.data();
+	result.size = scratch.size();
+	return true;
+}
+
+bool jsonreader::read_number(double& result) {
+	peek();
+	const char* begin = pos;
+	if (pos < end && *pos == '-') pos++;
+	const char* digits = pos;
+	while (pos < end && *pos >= '0' && *pos <= '9') pos++;
+	if (pos == digits || (*digits == '0' && pos - digits > 1)) {
+		pos = begin;
+		return error("invalid number");
+	}
+	if (pos < end && *pos == '.') {
+		digits = ++pos;
+		while (pos < end && *pos >= '0' && *pos <= '9') pos++;
+		if (pos == digits) return error("invalid number");
+	}
+	if (pos < end && (*pos == 'e' || *pos == 'E')) {
+		pos++;
+		if (pos < end && (*pos == '+' || *pos == '-')) pos++;
+		digits = pos;
+		while (pos < end && *pos >= '0' && *pos <= '9') pos++;
+		if (pos == digits) return error("invalid number");
+	}
+	result = strtod(string(begin, pos).c_str(), 0);
+	return true;
+}
+
+bool jsonreader::skip_value() {
+	jsontext text;
+	double number;
+	bool first = true, done = false;
+	switch (peek()) {
+		case '{':
+			if (++depth > 256) return error("nesting too deep");
+			pos++;
+			while (next_key(first, text, done) && !done) {
+				if (!skip_value()) return false;
+			}
+			depth--;
+			return done;
+		case '[':
+			if (++depth > 256) return error("nesting too deep");
+			pos++;
+			while (next_element(first, done) && !done) {
+				if (!skip_value()) return false;
+			}
+			depth--;
+			return done;
+		case '"':
+			return read_string(text);
+		case 't':
+			return literal("true");
+		case 'f':
+			return literal("false");
+		case 'n':
+			return literal("null");
+		case 0:
+			return error("unexpected end of file");
+		default:
+			if (peek() != '-' && (peek() < '0' || peek() > '9'))
+				return error("invalid value");
+			return read_number(number);
+	}
+}
+
+// reads a boolean into result. values of other types are skipped and
+// leave result unchanged.
+bool jsonreader::read_bool(bool& result) {
+	char c = peek();
+	if (c == 't') {
+		result = true;
+		return literal("true");
+	}
+	if (c == 'f') {
+		result = false;
+		return literal("false");
+	}
+	return skip_value();
+}
+
+// reads a number into result, truncated to an integer. values of other
+// types are skipped and leave result unchanged.
+bool jsonreader::read_int(int& result) {
+	char c = peek();
+	if (c != '-' && (c < '0' || c > '9'))
+		return skip_value();
+	double number;
+	if (!read_number(number))
+		return false;
+	result = (int)number;
+	return true;
+}
+
+// reads a string into result. values of other types are skipped and clear
+// result.
+bool jsonreader::read_string_value(std::string& result) {
+	result.clear();
+	if (peek() != '"')
+		return skip_value();
+	jsontext text;
+	if (!read_string(text))
+		return false;
+	result.assign(text.data, text.size);
+	return true;
+}
 
 bool table_has_foreign_key(tableinfo& tabinfo) {
 	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
@@ -79,89 +480,109 @@ bool parse_varchar(std::string name, int* size) {
 	return *size != 0;
 }
 
-std::string get_object_string(picojson::value obj, const std::string& name) {
-	picojson::value val = obj.get(name);
-	if (val.is<std::string>()) return val.get<std::string>();
-	return "";
+// reads a foreign table mapping object { "reftable", "refkey", "cascade" }
+bool parse_field_reference(jsonreader& reader, std::string& keytable, std::string& keyname, bool& cascade) {
+	reader.pos++;
+	bool first = true, done = false;
+	jsontext key;
+	while (reader.next_key(first, key, done) && !done) {
+		bool result;
+		if (key == "reftable")
+			result = reader.read_string_value(keytable);
+		else if (key == "refkey")
+			result = reader.read_string_value(keyname);
+		else if (key == "cascade")
+			result = reader.read_bool(cascade);
+		else
+			result = reader.skip_value();
+		if (!result) return false;
+	}
+	return done;
 }
 
-bool get_object_bool(picojson::value obj, const std::string& name, bool defvalue) {
-	picojson::value val = obj.get(name);
-	if (val.is<bool>()) return val.get<bool>();
-	return defvalue;
-}
+// reads a field array [ name, type, modifiers... ] into finfo
+bool parse_field(jsonreader& reader, const std::string& name, fieldinfo* finfo) {
+	jsonlocation fieldlocation = reader.here();
+	if (reader.peek() != '[')
+		return reader.error("field description contains non-array elements on " + name);
+	reader.pos++;
 
-bool parse_field(const picojson::array& fieldarray, fieldinfo* finfo) {
 	string fieldName;
 	int type = 0;
 	int size = 0;
 	bool nullable = true;
 	bool primary = false;
+	bool fulltext = false;
 	std::string keyname, keytable;
 	bool keycascade = true;
-	
-	for (picojson::value::array::const_iterator i = fieldarray.begin(); i != fieldarray.end(); ++i) {
-		size_t index = std::distance(fieldarray.begin(), i);
 
+	size_t index = 0;
+	bool first = true, done = false;
+	jsontext text;
+	while (reader.next_element(first, done) && !done) {
+		jsonlocation location = reader.here();
+		char c = reader.peek();
 		if (index == 0) {
-			if (i->is<std::string>()) {
-				fieldName = i->get<std::string>();
-			} else {
-				cerr << "invalid field name" << endl;
+			if (c != '"')
+				return reader.error(location, "invalid field name");
+			if (!reader.read_string(text))
 				return false;
-			}
+			fieldName = text.str();
 		} else
 		if (index == 1) {
-			if (i->is<std::string>()) {
-				string typeName = i->get<std::string>();
-				if (typeName == "int")
-					type = dbgen_integer;
-				else if (typeName == "bit")
-					type = dbgen_integer;
-				else if (typeName == "blob")
-					type = dbgen_blob;
-				else if (typeName == "float")
-					type = dbgen_float;
-				else if (typeName == "text")
-					type = dbgen_text;
-				else if (parse_varchar(typeName, &size))
-					type = dbgen_text;
-				else {
-					cerr << "unknown type '" << typeName << "'" << endl;
-					return false;
-				}
-			} else {
-				cerr << "unknown type declaration" << endl;
+			if (c != '"')
+				return reader.error(location, "unknown type declaration");
+			if (!reader.read_string(text))
 				return false;
-			}
+			string typeName = text.str();
+			if (typeName == "int")
+				type = dbgen_integer;
+			else if (typeName == "bit")
+				type = dbgen_integer;
+			else if (typeName == "blob")
+				type = dbgen_blob;
+			else if (typeName == "float")
+				type = dbgen_float;
+			else if (typeName == "text")
+				type = dbgen_text;
+			else if (parse_varchar(typeName, &size))
+				type = dbgen_text;
+			else
+				return reader.error(location, "unknown type '" + typeName + "'");
 		} else {
-			if (i->is<picojson::object>()) {
-				keytable = get_object_string(*i, "reftable");
-				keyname = get_object_string(*i, "refkey");
-				keycascade = get_object_bool(*i, "cascade", true); //fieldDecl.get("cascade", Json::Value(true)).asBool();
-			} else if (i->is<std::string>()) {
-				std::string declName = i->get<std::string>();
-				if (declName == "not null")
+			if (c == '{') {
+				if (!parse_field_reference(reader, keytable, keyname, keycascade))
+					return false;
+			} else if (c == '"') {
+				if (!reader.read_string(text))
+					return false;
+				if (text == "not null")
 					nullable = false;
-				else if (declName == "null")
+				else if (text == "null")
 					nullable = true;
-				else if (declName == "primary")
-					primary = true; 
-				else {
-					cerr << "unknown modifier " << declName << endl;
-					return false;
-				}
+				else if (text == "primary")
+					primary = true;
+				else if (text == "fulltext")
+					fulltext = true;
+				else
+					return reader.error(location, "unknown modifier " + text.str());
 			} else {
-				cerr << "unknown element in fields array" << endl;
-				return false;
+				return reader.error(location, "unknown element in fields array");
 			}
 		}
+		index++;
 	}
+	if (!done)
+		return false;
+
+	if (index < 2)
+		return reader.error(fieldlocation, "invalid field on " + name);
 	if ((keytable.length() != 0 && keyname.length() == 0) ||
 		(keytable.length() == 0 && keyname.length() != 0)) {
-		cerr << "invalid keytable or keyname" << endl;
-		return false;
+		return reader.error(fieldlocation, "invalid keytable or keyname");
 	}
+	if (fulltext && type != dbgen_text)
+		return reader.error(fieldlocation, "fulltext field " + fieldName + " on " + name + " must be text or varchar");
 
 	finfo->fieldname = fieldName;
 	finfo->primarykey = primary;
@@ -171,97 +592,208 @@ bool parse_field(const picojson::array& fieldarray, fieldinfo* finfo) {
 	finfo->keyname = keyname;
 	finfo->cascade = keycascade;
 	finfo->nullable = nullable;
-	
+	finfo->fulltext = fulltext;
+
 	return true;
 }
 
-bool parse_table_fields(const std::string& name, const picojson::value& fields, std::vector<fieldinfo>& result) {
-	const picojson::value::array& fieldsarray = fields.get<picojson::array>();
-
-	for (picojson::value::array::const_iterator i = fieldsarray.begin(); i != fieldsarray.end(); ++i) {
-		const picojson::value& field = *i;
-
-		if (!field.is<picojson::array>()) {
-			cerr << "field description contains non-array elements on " << name << endl;
-			return false;
-		}
-
-		const picojson::value::array& fieldarray = field.get<picojson::array>();
+bool parse_table_fields(jsonreader& reader, const std::string& name, std::vector<fieldinfo>& result) {
+	if (reader.peek() != '[')
+		return reader.error("fields of " + name + " must be an array");
+	reader.pos++;
 
-		if (fieldarray.size() < 2) {
-			cerr << "invalid field on " << name << endl;
-			return false;
-		}
+	result.clear();
+	bool first = true, done = false;
+	while (reader.next_element(first, done) && !done) {
 		fieldinfo finfo;
-		if (!parse_field(fieldarray, &finfo))
+		if (!parse_field(reader, name, &finfo))
 			return false;
 		result.push_back(finfo);
 	}
-
-	return true;
+	return done;
 }
 
-bool parse_table(const picojson::value& table, const std::string& name, tableinfo* tabinfo) {
-	picojson::value fields = table.get("fields");
-	if (!fields.is<picojson::array>()) return false;
+// sharded tables are routed by their integer key, and have no triggers and no
+// foreign keys since they are spread over several attached databases
+bool parse_shard_key(jsonreader& reader, const jsonlocation& location, tableinfo& tabinfo) {
+	bool hasprimary = false;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].primarykey) hasprimary = true;
+	}
 
-	tabinfo->tablename = name;
-	if (!parse_table_fields(name, fields, tabinfo->fields))
-		return false;
+	bool foundkey = false;
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		fieldinfo& finfo = tabinfo.fields[i];
+		if (!finfo.keytable.empty())
+			return reader.error(location, "sharded table " + tabinfo.tablename + " cannot have foreign keys");
+		if (finfo.fulltext)
+			return reader.error(location, "sharded table " + tabinfo.tablename + " cannot have fulltext fields");
+		if (finfo.fieldname != tabinfo.shardkey) continue;
+		if (finfo.type != dbgen_integer || (hasprimary ? !finfo.primarykey : finfo.fieldname != "id"))
+			return reader.error(location, "shard key " + tabinfo.shardkey + " must be the integer key of " + tabinfo.tablename);
+		foundkey = true;
+	}
+	if (!foundkey)
+		return reader.error(location, "shard key " + tabinfo.shardkey + " is not a field of " + tabinfo.tablename);
 
-	tabinfo->generate_before_insert = get_object_bool(table, "before_insert", false);
-	tabinfo->generate_after_insert = get_object_bool(table, "after_insert", false);
-	tabinfo->generate_before_update = get_object_bool(table, "before_update", false);
-	tabinfo->generate_after_update = get_object_bool(table, "after_update", false);
-	tabinfo->generate_before_delete = get_object_bool(table, "before_delete", false);
-	tabinfo->generate_after_delete = get_object_bool(table, "after_delete", false);
-	tabinfo->generate_undo = get_object_bool(table, "undo", true);
+	if (tabinfo.generate_before_insert || tabinfo.generate_after_insert || tabinfo.generate_before_update ||
+		tabinfo.generate_after_update || tabinfo.generate_before_delete || tabinfo.generate_after_delete || tabinfo.generate_undo) {
+		return reader.error(location, "sharded table " + tabinfo.tablename + " cannot have notify or undo triggers");
+	}
 	return true;
 }
 
-bool parse_events(const picojson::value& events, const std::string& name, tableinfo* tabinfo) {
-	if (!events.is<picojson::array>()) return false;
-
-	tabinfo->tablename = name;
-	return parse_table_fields(name, events, tabinfo->fields);
+// the fts5 index of a table refers to its rows by the integer id column
+bool parse_fulltext(jsonreader& reader, const jsonlocation& location, tableinfo& tabinfo) {
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].fieldname == "id" && tabinfo.fields[i].type == dbgen_integer)
+			return true;
+	}
+	return reader.error(location, "table " + tabinfo.tablename + " with fulltext fields must have an integer id field");
 }
 
-bool documentgenparser::parse_dbgen(const char* jsonfile, documentgen* result) {
-	
-	std::ifstream strm(jsonfile);
-	if (!strm) {
-		std::cerr << "cannot open " << jsonfile << endl;
-		return false;
+// snapshot rows are stored and looked up in the order of an integer key
+bool parse_snapshot(jsonreader& reader, const jsonlocation& location, tableinfo& tabinfo) {
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		if (tabinfo.fields[i].primarykey && tabinfo.fields[i].type == dbgen_integer)
+			return true;
 	}
+	return reader.error(location, "snapshot table " + tabinfo.tablename + " must have an integer field marked primary");
+}
 
-	picojson::value root;
-	std::string err = picojson::parse(root, strm);
-	bool parsingSuccessful = err.empty();
+bool parse_table(jsonreader& reader, const std::string& name, tableinfo* tabinfo) {
+	jsonlocation location = reader.here();
+	if (reader.peek() != '{')
+		return reader.error("table " + name + " must be an object");
+	reader.pos++;
 
-	if (!parsingSuccessful) {
-		std::cerr << "documentgen: failed to parse file: " << jsonfile << std::endl;
-		std::cerr << "documentgen: parsing error: " << err << std::endl;
-		return false;
-	}
+	tabinfo->tablename = name;
+	tabinfo->generate_before_insert = false;
+	tabinfo->generate_after_insert = false;
+	tabinfo->generate_before_update = false;
+	tabinfo->generate_after_update = false;
+	tabinfo->generate_before_delete = false;
+	tabinfo->generate_after_delete = false;
+	tabinfo->generate_snapshot = false;
+	bool hasfields = false, hasundo = false;
 
-	if (!root.is<picojson::object>()) return false;
-	picojson::value events = root.get("events");
-	picojson::value tables = root.get("tables");
+	bool first = true, done = false;
+	jsontext key;
+	while (reader.next_key(first, key, done) && !done) {
+		bool result;
+		if (key == "fields") {
+			result = parse_table_fields(reader, name, tabinfo->fields);
+			hasfields = true;
+		} else if (key == "before_insert")
+			result = reader.read_bool(tabinfo->generate_before_insert);
+		else if (key == "after_insert")
+			result = reader.read_bool(tabinfo->generate_after_insert);
+		else if (key == "before_update")
+			result = reader.read_bool(tabinfo->generate_before_update);
+		else if (key == "after_update")
+			result = reader.read_bool(tabinfo->generate_after_update);
+		else if (key == "before_delete")
+			result = reader.read_bool(tabinfo->generate_before_delete);
+		else if (key == "after_delete")
+			result = reader.read_bool(tabinfo->generate_after_delete);
+		else if (key == "snapshot")
+			result = reader.read_bool(tabinfo->generate_snapshot);
+		else if (key == "shard_key")
+			result = reader.read_string_value(tabinfo->shardkey);
+		else if (key == "undo") {
+			hasundo = reader.peek() == 't' || reader.peek() == 'f';
+			result = reader.read_bool(tabinfo->generate_undo);
+		} else
+			result = reader.skip_value();
+		if (!result) return false;
+	}
+	if (!done)
+		return false;
 
-	if (!events.is<picojson::null>() && !events.is<picojson::object>()) {
-		cerr << "could not parse events object";
+	if (!hasfields)
+		return reader.error(location, "table " + name + " has no fields array");
+	if (!hasundo)
+		tabinfo->generate_undo = tabinfo->shardkey.empty();
+	if (tabinfo->generate_snapshot && !parse_snapshot(reader, location, *tabinfo))
 		return false;
-	}
+	if (!tabinfo->shardkey.empty())
+		return parse_shard_key(reader, location, *tabinfo);
+	if (has_fulltext(*tabinfo))
+		return parse_fulltext(reader, location, *tabinfo);
+	return true;
+}
 
-	const picojson::value::object& tablesobj = tables.get<picojson::object>();
-	std::vector<tableinfo> tableinfos;
-	for (picojson::value::object::const_iterator i = tablesobj.begin(); i != tablesobj.end(); ++i) {
-		tableinfo tabinfo;
-		if (!parse_table(i->second, i->first, &tabinfo))
-			return false;
-		tableinfos.push_back(tabinfo);
+bool parse_options(jsonreader& reader, documentgen* result) {
+	char c = reader.peek();
+	if (c == 'n')
+		return reader.literal("null");
+	if (c != '{')
+		return reader.error("could not parse options object");
+	reader.pos++;
+
+	bool first = true, done = false;
+	jsontext key;
+	while (reader.next_key(first, key, done) && !done) {
+		jsonlocation location = reader.here();
+		bool ok;
+		if (key == "instrumentation")
+			ok = reader.read_bool(result->generate_instrumentation);
+		else if (key == "persistent_triggers")
+			ok = reader.read_bool(result->generate_persistent_triggers);
+		else if (key == "bulk_sessions")
+			ok = reader.read_bool(result->generate_bulk_sessions);
+		else if (key == "reader_pool")
+			ok = reader.read_bool(result->generate_reader_pool);
+		else if (key == "navigation")
+			ok = reader.read_bool(result->generate_navigation);
+		else if (key == "changed_columns")
+			ok = reader.read_bool(result->generate_changed_columns);
+		else if (key == "virtual_tables")
+			ok = reader.read_bool(result->generate_virtual_tables);
+		else if (key == "session_undo")
+			ok = reader.read_bool(result->generate_session_undo);
+		else if (key == "row_arena")
+			ok = reader.read_bool(result->generate_row_arena);
+		else if (key == "query_plan_check")
+			ok = reader.read_bool(result->generate_query_plan_check);
+		else if (key == "upsert")
+			ok = reader.read_bool(result->generate_upsert);
+		else if (key == "cursors")
+			ok = reader.read_bool(result->generate_cursors);
+		else if (key == "extern_templates")
+			ok = reader.read_bool(result->generate_extern_templates);
+		else if (key == "instances_per_table")
+			ok = reader.read_bool(result->generate_instances_per_table);
+		else if (key == "undo_dedup_bytes") {
+			ok = reader.read_int(result->undo_dedup_bytes);
+			if (ok && result->undo_dedup_bytes < 0)
+				return reader.error(location, "undo_dedup_bytes cannot be negative");
+		} else if (key == "shards") {
+			ok = reader.read_int(result->shard_count);
+			if (ok && result->shard_count < 1)
+				return reader.error(location, "shards must be at least 1");
+		} else
+			ok = reader.skip_value();
+		if (!ok) return false;
 	}
+	// the records of undo value references are rows of a temp table, which
+	// regular triggers cannot write
+	if (done && result->undo_dedup_bytes > 0 && result->generate_persistent_triggers)
+		return reader.error("undo_dedup_bytes cannot be used with persistent_triggers");
+	return done;
+}
 
+documentgenparser::documentgenparser()
+	: err(std::cerr)
+{
+}
+
+documentgenparser::documentgenparser(std::ostream& errstrm)
+	: err(errstrm)
+{
+}
+
+bool documentgenparser::sort_tables(std::vector<tableinfo>& tableinfos, std::vector<tableinfo>& result) {
 	// sort tables topologically
 	std::deque<tableinfo*> input;
 	for (size_t i = 0; i < tableinfos.size(); i++) {
@@ -271,37 +803,598 @@ bool documentgenparser::parse_dbgen(const char* jsonfile, documentgen* result) {
 	}
 
 	if (input.size() == 0) {
-		cerr << "no root table(s)" << endl;
+		err << "no root table(s)" << endl;
 		return false;
 	}
 
 	while (input.size()) {
 		tableinfo* intab = input.front();
 		input.pop_front();
-		result->tables.push_back(*intab);
+		result.push_back(*intab);
 
 		for (size_t i = 0; i < tableinfos.size(); i++) {
 			tableinfo& tabinfo = tableinfos[i];
-			if (table_has_foreign_keys(tabinfo, intab->tablename, result->tables) && !table_exists(result->tables, tabinfo.tablename)) {
+			if (table_has_foreign_keys(tabinfo, intab->tablename, result) && !table_exists(result, tabinfo.tablename)) {
 				input.push_back(&tabinfo);
 			}
 		}
 	}
 
-	if (result->tables.size() != tableinfos.size()) {
-		cerr << "warning: result table count mismatch" << endl;
+	if (result.size() != tableinfos.size()) {
+		err << "warning: result table count mismatch" << endl;
+	}
+	return true;
+}
+
+// tables and events are ordered by name, like the keys of a json object
+bool tablename_less(const tableinfo& a, const tableinfo& b) {
+	return a.tablename < b.tablename;
+}
+
+// reads an object of named tables or events. a repeated name replaces the
+// earlier entry.
+bool parse_tables(jsonreader& reader, const char* what, bool events, std::vector<tableinfo>& result) {
+	if (reader.peek() != '{')
+		return reader.error(string("could not parse ") + what + " object");
+	reader.pos++;
+
+	bool first = true, done = false;
+	jsontext key;
+	while (reader.next_key(first, key, done) && !done) {
+		tableinfo tabinfo;
+		tabinfo.tablename = key.str();
+		bool ok = events ? parse_table_fields(reader, tabinfo.tablename, tabinfo.fields) : parse_table(reader, tabinfo.tablename, &tabinfo);
+		if (!ok) return false;
+
+		size_t i = 0;
+		while (i < result.size() && result[i].tablename != tabinfo.tablename) i++;
+		if (i < result.size())
+			result[i] = tabinfo;
+		else
+			result.push_back(tabinfo);
+	}
+	if (!done)
+		return false;
+	std::sort(result.begin(), result.end(), tablename_less);
+	return true;
+}
+
+bool parse_imports(jsonreader& reader, std::vector<std::string>& imports) {
+	jsontext text;
+	char c = reader.peek();
+	if (c == '"') {
+		if (!reader.read_string(text)) return false;
+		imports.push_back(text.str());
+		return true;
+	}
+	if (c != '[')
+		return reader.error("import must be a file name or an array of file names");
+	reader.pos++;
+
+	bool first = true, done = false;
+	while (reader.next_element(first, done) && !done) {
+		if (reader.peek() != '"')
+			return reader.error("import must be a file name or an array of file names");
+		if (!reader.read_string(text)) return false;
+		imports.push_back(text.str());
+	}
+	return done;
+}
+
+// reads one module: its options, tables, events and the file names it imports
+bool parse_document(jsonreader& reader, documentgen* module, std::vector<std::string>& imports) {
+	if (reader.peek() != '{')
+		return reader.error("expected a document object");
+	reader.pos++;
+
+	bool hastables = false;
+	bool first = true, done = false;
+	jsontext key;
+	while (reader.next_key(first, key, done) && !done) {
+		bool ok;
+		if (key == "options") {
+			ok = parse_options(reader, module);
+		} else if (key == "import") {
+			ok = parse_imports(reader, imports);
+		} else if (key == "tables") {
+			module->tables.clear();
+			ok = parse_tables(reader, "tables", false, module->tables);
+			hastables = true;
+		} else if (key == "events") {
+			module->events.clear();
+			ok = reader.peek() == 'n' ? reader.literal("null") : parse_tables(reader, "events", true, module->events);
+		} else
+			ok = reader.skip_value();
+		if (!ok) return false;
+	}
+	if (!done)
+		return false;
+	if (reader.peek() != 0)
+		return reader.error("unexpected data after the document");
+	if (!hastables && imports.empty())
+		return reader.error("missing tables object");
+	return true;
+}
+
+// the binary form of a parsed module, stored in the cache directory as
+// <hash>.dbir where hash is the fnv1a hash of the module's json text. the
+// layout is native. module_ir_version must be incremented with every change
+// to write_module_body() or read_module_ir(), and with every member added to
+// fieldinfo, tableinfo or the options of documentgen, which must also be
+// written and read here. the header also holds module_ir_layout(), which
+// changes by itself with the serialized layout and the struct sizes.
+const char module_ir_magic[4] = { 'd', 'b', 'i', 'r' };
+const unsigned int module_ir_version = 7;
+
+struct irwriter {
+	std::string buffer;
+
+	void write(const void* data, size_t size) {
+		buffer.append((const char*)data, size);
+	}
+
+	void write_int(int value) {
+		write(&value, sizeof(value));
+	}
+
+	void write_bool(bool value) {
+		char byte = value ? 1 : 0;
+		write(&byte, 1);
+	}
+
+	void write_string(const std::string& value) {
+		write_int((int)value.size());
+		write(value.data(), value.size());
+	}
+};
+
+struct irreader {
+	const char* pos;
+	const char* end;
+
+	bool read(void* data, size_t size) {
+		if ((size_t)(end - pos) < size) return false;
+		memcpy(data, pos, size);
+		pos += size;
+		return true;
+	}
+
+	bool read_int(int& value) {
+		return read(&value, sizeof(value));
+	}
+
+	bool read_bool(bool& value) {
+		char byte;
+		if (!read(&byte, 1)) return false;
+		value = byte != 0;
+		return true;
+	}
+
+	bool read_string(std::string& value) {
+		int size;
+		if (!read_int(size) || size < 0 || end - pos < size) return false;
+		value.assign(pos, size);
+		pos += size;
+		return true;
+	}
+};
+
+void write_table_ir(irwriter& ir, const tableinfo& tabinfo) {
+	ir.write_string(tabinfo.tablename);
+	ir.write_int((int)tabinfo.fields.size());
+	for (size_t i = 0; i < tabinfo.fields.size(); i++) {
+		const fieldinfo& finfo = tabinfo.fields[i];
+		ir.write_string(finfo.fieldname);
+		ir.write_int(finfo.type);
+		ir.write_int(finfo.size);
+		ir.write_bool(finfo.primarykey);
+		ir.write_string(finfo.keytable);
+		ir.write_string(finfo.keyname);
+		ir.write_bool(finfo.cascade);
+		ir.write_bool(finfo.nullable);
+		ir.write_bool(finfo.fulltext);
+	}
+	ir.write_bool(tabinfo.generate_before_insert);
+	ir.write_bool(tabinfo.generate_after_insert);
+	ir.write_bool(tabinfo.generate_before_update);
+	ir.write_bool(tabinfo.generate_after_update);
+	ir.write_bool(tabinfo.generate_before_delete);
+	ir.write_bool(tabinfo.generate_after_delete);
+	ir.write_bool(tabinfo.generate_undo);
+	ir.write_string(tabinfo.shardkey);
+	ir.write_bool(tabinfo.generate_snapshot);
+}
+
+bool read_table_ir(irreader& ir, tableinfo& tabinfo) {
+	int count;
+	if (!ir.read_string(tabinfo.tablename) || !ir.read_int(count) || count < 0)
+		return false;
+	tabinfo.fields.resize(count);
+	for (int i = 0; i < count; i++) {
+		fieldinfo& finfo = tabinfo.fields[i];
+		if (!ir.read_string(finfo.fieldname) || !ir.read_int(finfo.type) || !ir.read_int(finfo.size) ||
+			!ir.read_bool(finfo.primarykey) || !ir.read_string(finfo.keytable) || !ir.read_string(finfo.keyname) ||
+			!ir.read_bool(finfo.cascade) || !ir.read_bool(finfo.nullable) || !ir.read_bool(finfo.fulltext))
+			return false;
+	}
+	return ir.read_bool(tabinfo.generate_before_insert) && ir.read_bool(tabinfo.generate_after_insert) &&
+		ir.read_bool(tabinfo.generate_before_update) && ir.read_bool(tabinfo.generate_after_update) &&
+		ir.read_bool(tabinfo.generate_before_delete) && ir.read_bool(tabinfo.generate_after_delete) &&
+		ir.read_bool(tabinfo.generate_undo) && ir.read_string(tabinfo.shardkey) && ir.read_bool(tabinfo.generate_snapshot);
+}
+
+void write_module_body(irwriter& ir, const documentgen& module, const std::vector<std::string>& imports) {
+	ir.write_bool(module.generate_instrumentation);
+	ir.write_bool(module.generate_changed_columns);
+	ir.write_bool(module.generate_persistent_triggers);
+	ir.write_bool(module.generate_bulk_sessions);
+	ir.write_bool(module.generate_reader_pool);
+	ir.write_bool(module.generate_navigation);
+	ir.write_bool(module.generate_virtual_tables);
+	ir.write_bool(module.generate_session_undo);
+	ir.write_bool(module.generate_row_arena);
+	ir.write_bool(module.generate_query_plan_check);
+	ir.write_bool(module.generate_upsert);
+	ir.write_bool(module.generate_cursors);
+	ir.write_bool(module.generate_extern_templates);
+	ir.write_bool(module.generate_instances_per_table);
+	ir.write_int(module.undo_dedup_bytes);
+	ir.write_int(module.shard_count);
+
+	ir.write_int((int)imports.size());
+	for (size_t i = 0; i < imports.size(); i++) {
+		ir.write_string(imports[i]);
+	}
+	ir.write_int((int)module.tables.size());
+	for (size_t i = 0; i < module.tables.size(); i++) {
+		write_table_ir(ir, module.tables[i]);
+	}
+	ir.write_int((int)module.events.size());
+	for (size_t i = 0; i < module.events.size(); i++) {
+		write_table_ir(ir, module.events[i]);
+	}
+}
+
+// a hash of the body written for a module with every option set and one
+// table with one field, and of the sizes of the structs read from it
+unsigned long long compute_module_ir_layout() {
+	fieldinfo finfo = fieldinfo();
+	finfo.fieldname = "f";
+	tableinfo tabinfo = tableinfo();
+	tabinfo.tablename = "t";
+	tabinfo.fields.push_back(finfo);
+	documentgen module;
+	module.generate_instrumentation = module.generate_changed_columns = module.generate_persistent_triggers = true;
+	module.generate_bulk_sessions = module.generate_reader_pool = module.generate_navigation = true;
+	module.generate_virtual_tables = module.generate_session_undo = module.generate_row_arena = true;
+	module.generate_query_plan_check = module.generate_upsert = module.generate_cursors = true;
+	module.generate_extern_templates = module.generate_instances_per_table = true;
+	module.tables.push_back(tabinfo);
+	module.events.push_back(tabinfo);
+
+	irwriter ir;
+	write_module_body(ir, module, std::vector<std::string>(1, "i"));
+	size_t sizes[] = { sizeof(fieldinfo), sizeof(tableinfo), sizeof(documentgen) };
+	ir.write(sizes, sizeof(sizes));
+	return fnv1a(ir.buffer);
+}
+
+unsigned long long module_ir_layout() {
+	static const unsigned long long layout = compute_module_ir_layout();
+	return layout;
+}
+
+void write_module_ir(irwriter& ir, unsigned long long hash, const documentgen& module, const std::vector<std::string>& imports) {
+	unsigned long long layout = module_ir_layout();
+	ir.write(module_ir_magic, sizeof(module_ir_magic));
+	ir.write(&module_ir_version, sizeof(module_ir_version));
+	ir.write(&layout, sizeof(layout));
+	ir.write(&hash, sizeof(hash));
+	write_module_body(ir, module, imports);
+}
+
+bool read_module_ir(irreader& ir, unsigned long long hash, documentgen& module, std::vector<std::string>& imports) {
+	char magic[4];
+	unsigned int version;
+	unsigned long long layout, irhash;
+	if (!ir.read(magic, sizeof(magic)) || memcmp(magic, module_ir_magic, sizeof(magic)) != 0 ||
+		!ir.read(&version, sizeof(version)) || version != module_ir_version ||
+		!ir.read(&layout, sizeof(layout)) || layout != module_ir_layout() ||
+		!ir.read(&irhash, sizeof(irhash)) || irhash != hash)
+		return false;
+
+	if (!ir.read_bool(module.generate_instrumentation) || !ir.read_bool(module.generate_changed_columns) ||
+		!ir.read_bool(module.generate_persistent_triggers) || !ir.read_bool(module.generate_bulk_sessions) ||
+		!ir.read_bool(module.generate_reader_pool) || !ir.read_bool(module.generate_navigation) ||
+		!ir.read_bool(module.generate_virtual_tables) || !ir.read_bool(module.generate_session_undo) ||
+		!ir.read_bool(module.generate_row_arena) || !ir.read_bool(module.generate_query_plan_check) ||
+		!ir.read_bool(module.generate_upsert) || !ir.read_bool(module.generate_cursors) ||
+		!ir.read_bool(module.generate_extern_templates) || !ir.read_bool(module.generate_instances_per_table) ||
+		!ir.read_int(module.undo_dedup_bytes) || !ir.read_int(module.shard_count))
+		return false;
+
+	int count;
+	if (!ir.read_int(count) || count < 0) return false;
+	imports.resize(count);
+	for (int i = 0; i < count; i++) {
+		if (!ir.read_string(imports[i])) return false;
+	}
+	if (!ir.read_int(count) || count < 0) return false;
+	module.tables.resize(count);
+	for (int i = 0; i < count; i++) {
+		if (!read_table_ir(ir, module.tables[i])) return false;
+	}
+	if (!ir.read_int(count) || count < 0) return false;
+	module.events.resize(count);
+	for (int i = 0; i < count; i++) {
+		if (!read_table_ir(ir, module.events[i])) return false;
+	}
+	return ir.pos == ir.end;
+}
+
+std::string directory_of(const std::string& filename) {
+	std::string::size_type ls = filename.find_last_of("/\\");
+	return ls != std::string::npos ? filename.substr(0, ls + 1) : "";
+}
+
+bool is_absolute_path(const std::string& filename) {
+	if (filename.empty()) return false;
+#if defined(_WIN32)
+	if (filename.size() > 1 && filename[1] == ':') return true;
+	if (filename[0] == '\\') return true;
+#endif
+	return filename[0] == '/';
+}
+
+// returns the absolute path of an existing file, used to recognize a module
+// imported through different relative paths
+std::string canonical_path(const std::string& filename) {
+#if defined(_WIN32)
+	char* path = _fullpath(0, filename.c_str(), 0);
+#else
+	char* path = realpath(filename.c_str(), 0);
+#endif
+	if (!path) return filename;
+	std::string result = path;
+	free(path);
+	return result;
+}
+
+// the number of modules kept in a cache directory. reading a module from the
+// cache touches it, and writing one removes the least recently used modules
+// beyond the limit.
+const size_t module_cache_limit = 256;
+
+struct cachedmodule {
+	std::string filename;
+	long long time;
+
+	bool operator<(const cachedmodule& other) const { return time > other.time; }
+};
+
+void touch_file(const std::string& filename) {
+#if defined(_WIN32)
+	_utime(filename.c_str(), 0);
+#else
+	utime(filename.c_str(), 0);
+#endif
+}
+
+// lists the modules in a cache directory, most recently used first
+std::vector<cachedmodule> list_cached_modules(const std::string& directory) {
+	std::vector<cachedmodule> result;
+#if defined(_WIN32)
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "*.dbir").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return result;
+	do {
+		cachedmodule module;
+		module.filename = directory + data.cFileName;
+		module.time = ((long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+		result.push_back(module);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return result;
+	while (struct dirent* entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		struct stat info;
+		if (name.size() < 5 || name.compare(name.size() - 5, 5, ".dbir") != 0 || stat((directory + name).c_str(), &info) != 0)
+			continue;
+		cachedmodule module;
+		module.filename = directory + name;
+		module.time = (long long)info.st_mtime;
+		result.push_back(module);
+	}
+	closedir(dir);
+#endif
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+// loads a schema and the modules it imports, each once. with a cache
+// directory, parsed modules are stored in their binary form and read back
+// while the hash of their json text is unchanged.
+struct moduleloader {
+	std::ostream& err;
+	std::string cachedir;
+	documentgen* result;
+	std::vector<std::string> loaded; // canonical paths of loaded modules
+	std::vector<std::string> importing; // modules whose imports are being loaded
+	std::vector<std::string> tablesources;
+	std::vector<std::string> eventsources;
+
+	moduleloader(std::ostream& errstrm, const std::string& dir, documentgen* doc) : err(errstrm), cachedir(dir), result(doc) {}
+
+	std::string cache_directory();
+	std::string cache_filename(unsigned long long hash);
+	bool read_cached(unsigned long long hash, documentgen& module, std::vector<std::string>& imports);
+	void write_cached(unsigned long long hash, const documentgen& module, const std::vector<std::string>& imports);
+	void evict_cached();
+	bool add_tables(std::vector<tableinfo>& from, std::vector<tableinfo>& to, std::vector<std::string>& sources, const std::string& filename);
+	bool load(const std::string& filename, bool root);
+};
+
+std::string moduleloader::cache_directory() {
+	if (!cachedir.empty() && cachedir[cachedir.size() - 1] != '/' && cachedir[cachedir.size() - 1] != '\\')
+		return cachedir + "/";
+	return cachedir;
+}
+
+std::string moduleloader::cache_filename(unsigned long long hash) {
+	std::stringstream result;
+	result << cache_directory() << std::hex << hash << ".dbir";
+	return result.str();
+}
+
+// a module which cannot be read completely is left empty, so it can be
+// parsed into
+bool moduleloader::read_cached(unsigned long long hash, documentgen& module, std::vector<std::string>& imports) {
+	if (cachedir.empty()) return false;
+	std::string filename = cache_filename(hash);
+	mappedfile file;
+	if (!file.open(filename.c_str())) return false;
+	irreader ir;
+	ir.pos = file.data;
+	ir.end = file.data + file.size;
+	imports.clear();
+	if (!read_module_ir(ir, hash, module, imports)) {
+		module = documentgen();
+		imports.clear();
+		return false;
+	}
+	touch_file(filename);
+	return true;
+}
+
+// the module is written to a temporary file which is renamed into place, so
+// concurrent runs sharing a cache directory never read a partial module
+void moduleloader::write_cached(unsigned long long hash, const documentgen& module, const std::vector<std::string>& imports) {
+	if (cachedir.empty()) return;
+	irwriter ir;
+	write_module_ir(ir, hash, module, imports);
+
+	static std::atomic<unsigned int> counter(0);
+	std::string filename = cache_filename(hash);
+	std::stringstream tempname;
+#if defined(_WIN32)
+	tempname << filename << "." << GetCurrentProcessId() << "." << counter++ << ".tmp";
+#else
+	tempname << filename << "." << getpid() << "." << counter++ << ".tmp";
+#endif
+	std::ofstream strm(tempname.str().c_str(), std::ios::binary | std::ios::trunc);
+	if (!strm) return;
+	strm.write(ir.buffer.data(), ir.buffer.size());
+	strm.close();
+	if (!strm || std::rename(tempname.str().c_str(), filename.c_str()) != 0)
+		std::remove(tempname.str().c_str());
+	else
+		evict_cached();
+}
+
+// modules removed by a concurrent run, or still mapped by one, are skipped
+void moduleloader::evict_cached() {
+	std::vector<cachedmodule> modules = list_cached_modules(cache_directory());
+	for (size_t i = module_cache_limit; i < modules.size(); i++) {
+		std::remove(modules[i].filename.c_str());
 	}
-	
-	if (!events.is<picojson::null>()) {
-		const picojson::value::object& eventsobj = events.get<picojson::object>();
+}
 
-		for (picojson::value::object::const_iterator i = eventsobj.begin(); i != eventsobj.end(); ++i) {
-			tableinfo tabinfo;
-			tabinfo.tablename = i->first;
-			if (!parse_table_fields(i->first, i->second, tabinfo.fields))
+bool moduleloader::add_tables(std::vector<tableinfo>& from, std::vector<tableinfo>& to, std::vector<std::string>& sources, const std::string& filename) {
+	for (size_t i = 0; i < from.size(); i++) {
+		for (size_t j = 0; j < to.size(); j++) {
+			if (to[j].tablename == from[i].tablename) {
+				err << from[i].tablename << " in " << filename << " is already defined in " << sources[j] << endl;
 				return false;
-			result->events.push_back(tabinfo);
+			}
 		}
+		to.push_back(from[i]);
+		sources.push_back(filename);
+	}
+	return true;
+}
+
+// imports are relative to the importing file. the options of imported
+// modules are ignored.
+bool moduleloader::load(const std::string& filename, bool root) {
+	std::string canonical = canonical_path(filename);
+	if (std::find(importing.begin(), importing.end(), canonical) != importing.end()) {
+		err << "import cycle through " << filename << endl;
+		return false;
+	}
+	if (std::find(loaded.begin(), loaded.end(), canonical) != loaded.end())
+		return true;
+
+	mappedfile file;
+	if (!file.open(filename.c_str())) {
+		err << "cannot open " << filename << endl;
+		return false;
+	}
+
+	unsigned long long hash = fnv1a(file.data, file.size);
+	documentgen module;
+	std::vector<std::string> imports;
+	if (!read_cached(hash, module, imports)) {
+		jsonreader reader(file.data, file.size, err);
+		if (!root)
+			reader.source = filename;
+		imports.clear();
+		if (!parse_document(reader, &module, imports))
+			return false;
+		write_cached(hash, module, imports);
+	}
+
+	if (root) {
+		*result = module;
+		result->tables.clear();
+		result->events.clear();
+	}
+	if (!add_tables(module.tables, result->tables, tablesources, filename) ||
+		!add_tables(module.events, result->events, eventsources, filename))
+		return false;
+
+	importing.push_back(canonical);
+	for (size_t i = 0; i < imports.size(); i++) {
+		std::string path = is_absolute_path(imports[i]) ? imports[i] : directory_of(filename) + imports[i];
+		if (!load(path, false))
+			return false;
 	}
+	importing.pop_back();
+	loaded.push_back(canonical);
 	return true;
 }
+
+bool documentgenparser::parse_dbgen(const char* jsonfile, documentgen* result) {
+
+	moduleloader loader(err, cachedir, result);
+	if (!loader.load(jsonfile, true))
+		return false;
+
+	std::vector<tableinfo> tableinfos;
+	tableinfos.swap(result->tables);
+	std::sort(tableinfos.begin(), tableinfos.end(), tablename_less);
+	std::sort(result->events.begin(), result->events.end(), tablename_less);
+
+	for (size_t i = 0; i < tableinfos.size(); i++) {
+		for (size_t j = 0; j < tableinfos[i].fields.size(); j++) {
+			fieldinfo& finfo = tableinfos[i].fields[j];
+			if (finfo.keytable.empty())
+				continue;
+			size_t k = 0;
+			while (k < tableinfos.size() && tableinfos[k].tablename != finfo.keytable) k++;
+			if (k == tableinfos.size()) {
+				err << tableinfos[i].tablename << "." << finfo.fieldname << " references unknown table " << finfo.keytable << endl;
+				return false;
+			}
+			if (!tableinfos[k].shardkey.empty()) {
+				err << tableinfos[i].tablename << " cannot reference sharded table " << finfo.keytable << endl;
+				return false;
+			}
+		}
+	}
+
+	return sort_tables(tableinfos, result->tables);
+}
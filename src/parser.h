@@ -5,6 +5,11 @@ struct fieldinfo;
 struct tableinfo;
 
 struct documentgenparser {
+	std::ostream& err;
+	std::string cachedir; // binary module cache, disabled when empty
+
+	documentgenparser();
+	documentgenparser(std::ostream& errstrm);
 	bool parse_dbgen(const char* jsonfile, documentgen* result);
+	bool sort_tables(std::vector<tableinfo>& tableinfos, std::vector<tableinfo>& result);
 };
-
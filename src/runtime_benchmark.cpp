@@ -0,0 +1,316 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sqlite3.h>
+#include <boost/mpl/vector.hpp>
+#include <boost/mpl/for_each.hpp>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#ifdef RUNTIME_BENCHMARK_BULK
+#include "runtime_benchmark_bulk_types.h"
+#include "benchmark_runtime.h"
+#include "runtime_benchmark_bulk_types_cpp.h"
+#else
+#include "runtime_benchmark_types.h"
+#include "benchmark_runtime.h"
+#include "runtime_benchmark_types_cpp.h"
+#endif
+
+// measures the cost of the generated triggers on an in-memory database. each
+// configuration uses its own table from runtime_benchmark.dbgen, so all
+// configurations run against the same generated code:
+//
+//   plain      no triggers
+//   callbacks  after insert/update/delete notify callbacks
+//   undo       undo triggers only
+//   both       notify callbacks and undo triggers
+//   both_bulk  the both table inside a bulk session, only in
+//              dbgenpp_runtime_benchmark_bulk built from
+//              runtime_benchmark_bulk.dbgen
+//   chainN     cascade delete through N child tables
+
+static const int max_cascade_depth = 8;
+
+struct counting_sink : dbgenpp::event_sink<document_event_data> {
+	long long events;
+
+	counting_sink() : events(0) {}
+
+	bool notify(document_event_data&) {
+		events++;
+		return true;
+	}
+};
+
+std::vector<std::string> undo_queries;
+bool undo_enabled = true;
+
+extern "C" void undoredo_add_query(sqlite3_context* ctx, int, sqlite3_value** argv) {
+	const unsigned char* text = sqlite3_value_text(argv[0]);
+	undo_queries.push_back(std::string((const char*)text, sqlite3_value_bytes(argv[0])));
+	sqlite3_result_int(ctx, 1);
+}
+
+extern "C" void undoredo_enabled_callback(sqlite3_context* ctx, int, sqlite3_value**) {
+	sqlite3_result_int(ctx, undo_enabled ? 1 : 0);
+}
+
+bool exec(sqlite3* db, const std::string& query) {
+	char* errmsg = 0;
+	if (sqlite3_exec(db, query.c_str(), 0, 0, &errmsg) != SQLITE_OK) {
+		cerr << "sqlite error: " << (errmsg ? errmsg : "") << endl;
+		sqlite3_free(errmsg);
+		return false;
+	}
+	return true;
+}
+
+sqlite3_stmt* prepare(sqlite3* db, const std::string& query) {
+	sqlite3_stmt* stmt = 0;
+	if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, 0) != SQLITE_OK) {
+		cerr << "sqlite error: " << sqlite3_errmsg(db) << endl;
+		return 0;
+	}
+	return stmt;
+}
+
+// the constant single record statements of a table from its table_traits,
+// and its column names in column_members order, so the parameter ?N binds
+// the column columns[N - 1]
+struct table_statements {
+	std::string insert;
+	std::string update;
+	std::string remove;
+	std::vector<std::string> columns;
+};
+
+typedef std::map<std::string, table_statements> statement_map;
+
+struct collect_column_names {
+	std::vector<std::string>* columns;
+
+	collect_column_names(std::vector<std::string>* c) : columns(c) {}
+
+	template <typename C>
+	void operator()(C) { columns->push_back(C::name()); }
+};
+
+struct collect_statements {
+	statement_map* statements;
+
+	collect_statements(statement_map* s) : statements(s) {}
+
+	template <typename T>
+	void operator()(T) {
+		table_statements& table = (*statements)[T::table_traits::name()];
+		table.insert = T::table_traits::insert_query();
+		table.update = T::table_traits::update_query();
+		table.remove = T::table_traits::delete_query();
+		boost::mpl::for_each<typename T::column_members>(collect_column_names(&table.columns));
+	}
+};
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+struct operationtimings {
+	std::vector<double> us;
+	double total_ms;
+};
+
+// runs a prepared statement once per row, binding the row number to the id
+// and parent_id columns, and records the latency of each step
+bool run_statement(sqlite3* db, sqlite3_stmt* stmt, const table_statements& table, int rows, const std::vector<unsigned char>& payload, operationtimings* timings) {
+	timings->us.clear();
+	timings->us.reserve(rows);
+
+	std::vector<std::string> params;
+	for (int p = 1; p <= sqlite3_bind_parameter_count(stmt); p++) {
+		const char* name = sqlite3_bind_parameter_name(stmt, p);
+		int column = name && name[0] == '?' ? atoi(name + 1) - 1 : -1;
+		params.push_back(column >= 0 && column < (int)table.columns.size() ? table.columns[column] : "");
+	}
+
+	exec(db, "begin;");
+	benchmark_clock::time_point begin = benchmark_clock::now();
+	for (int i = 1; i <= rows; i++) {
+		benchmark_clock::time_point start = benchmark_clock::now();
+		for (size_t p = 0; p < params.size(); p++) {
+			const std::string& param = params[p];
+			if (param == "id" || param == "parent_id")
+				sqlite3_bind_int(stmt, (int)p + 1, i);
+			else if (param == "name")
+				sqlite3_bind_text(stmt, (int)p + 1, "benchmark row", -1, SQLITE_STATIC);
+			else if (param == "value")
+				sqlite3_bind_double(stmt, (int)p + 1, i * 0.5);
+			else if (param == "payload")
+				sqlite3_bind_blob(stmt, (int)p + 1, &payload.front(), (int)payload.size(), SQLITE_STATIC);
+		}
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			cerr << "sqlite error: " << sqlite3_errmsg(db) << endl;
+			sqlite3_reset(stmt);
+			exec(db, "rollback;");
+			return false;
+		}
+		sqlite3_reset(stmt);
+		timings->us.push_back(std::chrono::duration<double, std::micro>(benchmark_clock::now() - start).count());
+	}
+	timings->total_ms = std::chrono::duration<double, std::milli>(benchmark_clock::now() - begin).count();
+	exec(db, "commit;");
+	return true;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+	size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+void write_row(const std::string& config, const std::string& operation, int rows, operationtimings& timings) {
+	std::vector<double> sorted = timings.us;
+	std::sort(sorted.begin(), sorted.end());
+	cout << config << "," << operation << "," << rows << ",";
+	cout << timings.total_ms << "," << (rows / (timings.total_ms / 1000.0)) << ",";
+	cout << percentile(sorted, 0.5) << "," << percentile(sorted, 0.95) << "," << percentile(sorted, 0.99) << "," << sorted.back() << endl;
+}
+
+bool run_table(sqlite3* db, const table_statements& table, const std::string& config, int rows, const std::vector<unsigned char>& payload) {
+	operationtimings timings;
+
+	sqlite3_stmt* insertstmt = prepare(db, table.insert);
+	sqlite3_stmt* updatestmt = prepare(db, table.update);
+	sqlite3_stmt* deletestmt = prepare(db, table.remove);
+	if (!insertstmt || !updatestmt || !deletestmt) {
+		sqlite3_finalize(insertstmt);
+		sqlite3_finalize(updatestmt);
+		sqlite3_finalize(deletestmt);
+		return false;
+	}
+
+	bool result = run_statement(db, insertstmt, table, rows, payload, &timings);
+	if (result) write_row(config, "insert", rows, timings);
+	result = result && run_statement(db, updatestmt, table, rows, payload, &timings);
+	if (result) write_row(config, "update", rows, timings);
+	result = result && run_statement(db, deletestmt, table, rows, payload, &timings);
+	if (result) write_row(config, "delete", rows, timings);
+
+	sqlite3_finalize(insertstmt);
+	sqlite3_finalize(updatestmt);
+	sqlite3_finalize(deletestmt);
+	undo_queries.clear();
+	return result;
+}
+
+// fills chain0..chainN with one child per parent and measures deleting the
+// roots, each of which cascades through depth child rows
+bool run_cascade(sqlite3* db, statement_map& statements, int depth, int rows, const std::vector<unsigned char>& payload) {
+	operationtimings timings;
+
+	for (int level = 0; level <= depth; level++) {
+		std::stringstream name;
+		name << "chain" << level;
+		const table_statements& table = statements[name.str()];
+		sqlite3_stmt* stmt = prepare(db, table.insert);
+		if (!stmt || !run_statement(db, stmt, table, rows, payload, &timings)) {
+			sqlite3_finalize(stmt);
+			return false;
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	const table_statements& root = statements["chain0"];
+	sqlite3_stmt* deletestmt = prepare(db, root.remove);
+	if (!deletestmt)
+		return false;
+	bool result = run_statement(db, deletestmt, root, rows, payload, &timings);
+	sqlite3_finalize(deletestmt);
+	if (!result)
+		return false;
+
+	std::stringstream config;
+	config << "cascade_depth_" << depth;
+	write_row(config.str(), "delete", rows, timings);
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	int rows = 10000;
+	int payloadsize = 256;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--verify-plans") {
+			query_plan_report report;
+			if (verify_query_plans(cerr, &report))
+				return 0;
+			cerr << report.failures << " of " << report.statements << " statements cannot be prepared, " << report.scans << " scan a table" << endl;
+			return report.failures > 0 ? 4 : 3;
+		}
+		else if (arg == "--rows" && i + 1 < argc)
+			rows = atoi(argv[++i]);
+		else if (arg == "--payload-bytes" && i + 1 < argc)
+			payloadsize = atoi(argv[++i]);
+		else {
+			cout << "usage: dbgenpp_runtime_benchmark [--rows N] [--payload-bytes N]" << endl;
+			cout << "       dbgenpp_runtime_benchmark --verify-plans" << endl << endl;
+			return 1;
+		}
+	}
+	if (rows <= 0 || payloadsize <= 0) {
+		cerr << "rows and payload size must be positive" << endl;
+		return 1;
+	}
+
+	std::vector<unsigned char> payload(payloadsize);
+	for (size_t i = 0; i < payload.size(); i++) payload[i] = (unsigned char)i;
+
+	sqlite3* db = 0;
+	if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+		cerr << "cannot open in-memory database" << endl;
+		return 2;
+	}
+
+	counting_sink sink;
+	sqlite3_create_function(db, "undoredo_add_query", 1, SQLITE_ANY, 0, undoredo_add_query, 0, 0);
+	sqlite3_create_function(db, "undoredo_enabled_callback", 0, SQLITE_ANY, 0, undoredo_enabled_callback, 0, 0);
+	create_callbacks(db, &sink);
+
+	std::stringstream tablesquery, triggersquery;
+	create_tables(tablesquery, "");
+	create_triggers(db, triggersquery);
+	if (!exec(db, tablesquery.str()) || !exec(db, triggersquery.str())) {
+		sqlite3_close(db);
+		return 2;
+	}
+
+	statement_map statements;
+	boost::mpl::for_each<database_tables>(collect_statements(&statements));
+
+	cout << "config,operation,rows,total_ms,ops_per_sec,p50_us,p95_us,p99_us,max_us" << endl;
+
+	const char* tables[] = { "plain", "callbacks", "undo", "both" };
+	bool result = true;
+	for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]) && result; i++) {
+		result = run_table(db, statements[tables[i]], tables[i], rows, payload);
+	}
+#ifdef RUNTIME_BENCHMARK_BULK
+	if (result) {
+		bulk_session session;
+		result = begin_bulk_session(db, session);
+		result = result && run_table(db, statements["both"], "both_bulk", rows, payload);
+		result = end_bulk_session(db, session) && result;
+	}
+#endif
+	for (int depth = 1; depth <= max_cascade_depth && result; depth++) {
+		result = run_cascade(db, statements, depth, rows, payload);
+	}
+
+	sqlite3_close(db);
+	return result ? 0 : 2;
+}
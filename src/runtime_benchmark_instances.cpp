@@ -0,0 +1,13 @@
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include <boost/mpl/vector.hpp>
+#include <boost/mpl/for_each.hpp>
+
+#include "runtime_benchmark_bulk_types.h"
+#include "benchmark_runtime.h"
+
+// runtime_benchmark_bulk.dbgen enables "extern_templates", so the run time
+// templates used by the generated notify callbacks of the bulk benchmark are
+// instantiated here instead of in runtime_benchmark.cpp
+#include "runtime_benchmark_bulk_instances_cpp.h"